@@ -68,6 +68,9 @@ void f2fs_updateCP(unsigned int dataAddr){
 			else{
 				memcpy(&sum, sum_block, sizeof(struct f2fs_summary_block));	
 			}
+			// the inodes written since the last checkpoint have a new block in the journal
+			for (int i = 0; i < sum.n_nats; i++)
+				cacheSnoopInode(sum.nat_j.entries[i].nid, sum.nat_j.entries[i].ne.block_addr);
 		}
 		xil_printf("[updateCP] cp update successfully.\r\n");
 // #ifdef DEBUG
@@ -83,6 +86,8 @@ void f2fs_updateCP(unsigned int dataAddr){
 
 			if (sum_block->n_nats != sum.n_nats){  // if no nat_journals in sum block, it is not necessary to memcpy
 				memcpy(&sum, sum_block, sizeof(struct f2fs_summary_block));	
+				for (int i = 0; i < sum.n_nats; i++)
+					cacheSnoopInode(sum.nat_j.entries[i].nid, sum.nat_j.entries[i].ne.block_addr);
 			}
 		}
 		printf("[updateCP] n_nats in summary block: %x\r\n", sum.n_nats);
@@ -199,6 +204,15 @@ unsigned int read_data_sync(unsigned int blk_addr, unsigned int blk_num){
 	return 0;
 }
 
+// the block address of the inode, from the nat journal or the NAT, F2FS writes a changed inode to a new block
+unsigned int get_inode_blkaddr(unsigned int ino){
+	for (int i = 0; i < sum.n_nats; i++)
+		if (sum.nat_j.entries[i].nid == ino)
+			return sum.nat_j.entries[i].ne.block_addr;
+
+	return f2fs_read_NAT(ino, &sb, &ckpt);
+}
+
 // Load the inode from flash and return the addr
 unsigned int read_inode(unsigned int ino){
 	unsigned int inode_pbn = 0;
@@ -364,6 +364,7 @@ unsigned int f2fs_find_dir(struct f2fs_super_block* sb, struct f2fs_checkpoint *
 void init_metadata();
 int extract_dir(const char* path, const unsigned int path_len, unsigned int *dir_offset, unsigned int *dir_len);
 unsigned int read_inode(unsigned int ino);
+unsigned int get_inode_blkaddr(unsigned int ino);
 /*receive path of file,return the LBA of inode of this file*/
 unsigned int f2fs_path_crawl(char* filename, unsigned int len);
 
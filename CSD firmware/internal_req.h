@@ -90,7 +90,12 @@ typedef struct _LOW_LEVEL_REQ_INFO
 
 	unsigned int search : 1;  // to judge whether this entry is a regular or a search entry
 	// unsigned int searchBufferEntry : 8;  // identifies the buffer entry to which this entry belongs
+	unsigned int searchTaskId : 8;  // the slot of the task table the page belongs to
 	unsigned int searchPageIndex;
+	unsigned int searchLpn;  // to read the page again if the read fails
+	unsigned int searchStart : 16;  // the bytes [searchStart, searchEnd) of the page belong to the search
+	unsigned int searchEnd : 16;
+	unsigned long long searchOffset;  // file offset of searchStart
 	unsigned int reserved : 23;
 }LOW_LEVEL_REQ_INFO, *P_LOW_LEVEL_REQ_INFO;
 
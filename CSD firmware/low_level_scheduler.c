@@ -90,6 +90,7 @@
 
 #include "FSR_f2fs.h"
 #include "search.h"
+#include "ndp.h"
 
 struct reqArray* reqQueue;
 struct rqPointerArray* rqPointer;
@@ -106,99 +107,218 @@ struct wayPriorityArray* wayPriorityTable;
 unsigned int reservedReq;
 unsigned int badBlockUpdate;
 
-int CheckSearchTaskConfigDMA(){
-	if(check_auto_rx_dma_partial_done(searchTask->rxDmaTail, searchTask->rxDmaOverFlowCnt)){
-		searchTask->rxDmaExe = 0;
-
-		char* index = (char*)DMA_TASK_CONFIG_ADDR;  // copy addr
-		strcpy(searchTask->targetString, index);
+struct qosCounter qosCounter;
+static unsigned char hostAhead[CHANNEL_NUM][WAY_NUM];  // host entries let ahead of the search read at the front of the die
+
+// the config of the selected task is in, compile the task and find its pages, FeedSearchTasks() queues them from then on
+int StartSearchTask(){
+	char* index = (char*)(DMA_TASK_CONFIG_ADDR + searchTask->taskId * SEARCH_CONFIG_MAX_UNIT * 4096);  // copy addr
+	char* config = index;
+	char* configEnd = index + searchTask->configUnit * 4096;
+	unsigned int patternSize = ndpCompile(index);
+	if (patternSize == 0){  // bad pattern set, terminate the task
+		abort_task();
+		xil_printf("[StartSearchTask] failed to compile the patterns, this task is terminated.\r\n");
+		return 0;
+	}
+	index += patternSize;  // skip the patterns
 
-		if (searchTask->need_path_walk) {  // need path walk
-			index += 16;  // skip the target string
-			unsigned int path_len = *((unsigned int *)index);
-			index += 4;
-			char path[path_len + 1];
-			memcpy(path, index, path_len);
-			path[path_len] = '\0';
+	struct searchWindow* window = (struct searchWindow*)index;
+	index += sizeof(struct searchWindow);
+	if (window->timeoutMs){
+		XTime_GetTime(&searchTask->deadline);
+		searchTask->deadline += ((XTime) window->timeoutMs) * (COUNTS_PER_SECOND / 1000);
+	}
 
-			XTime_GetTime(&time_start_retrieve);
-			unsigned int file_ino = f2fs_path_crawl(path, path_len);
-			if (file_ino == 0){  // f2fs_path_crawl failed, terminate the task
-				abort_task();
-				xil_printf("[CheckSearchTaskConfigDMA] failed to find the ino of the file, this task is terminated.\r\n");
-				return 0;
-			}
-			
-			XTime_GetTime(&time_end_retrieve);
-
-			// ========= for performance testing ==========
-		// read_inode(file_ino);
-		// abort_task();
-		// unsigned int t_total, tUsed;
-		// t_total = ((time_end_retrieve - time_start_search) * 1000000) / (COUNTS_PER_SECOND);
-		// tUsed = ((time_end_retrieve - time_start_retrieve) * 1000000) / (COUNTS_PER_SECOND);
-		// xil_printf("Total time: %d us. Time of retrieve:  %d us.\r\n", t_total, tUsed);
-		// xil_printf("nat read hit: %d, nat read miss: %d, data read hit: %d, data read miss: %d.\r\n", nat_read_hit, nat_read_miss, data_read_hit, data_read_miss);
-		// nat_read_hit = nat_read_miss = data_read_hit = data_read_miss = 0;
+	if (searchTask->need_path_walk) {  // need path walk
+		unsigned int path_len = *((unsigned int *)index);
+		index += 4;
+		char path[path_len + 1];
+		memcpy(path, index, path_len);
+		path[path_len] = '\0';
+
+		XTime_GetTime(&time_start_retrieve);
+		unsigned int file_ino = f2fs_path_crawl(path, path_len);
+		if (file_ino == 0){  // f2fs_path_crawl failed, terminate the task
+			abort_task();
+			xil_printf("[StartSearchTask] failed to find the ino of the file, this task is terminated.\r\n");
+			return 0;
+		}
 		
+		XTime_GetTime(&time_end_retrieve);
+
+		// ========= for performance testing ==========
+	// read_inode(file_ino);
+	// abort_task();
+	// unsigned int t_total, tUsed;
+	// t_total = ((time_end_retrieve - time_start_search) * 1000000) / (COUNTS_PER_SECOND);
+	// tUsed = ((time_end_retrieve - time_start_retrieve) * 1000000) / (COUNTS_PER_SECOND);
+	// xil_printf("Total time: %d us. Time of retrieve:  %d us.\r\n", t_total, tUsed);
+	// xil_printf("nat read hit: %d, nat read miss: %d, data read hit: %d, data read miss: %d.\r\n", nat_read_hit, nat_read_miss, data_read_hit, data_read_miss);
+	// nat_read_hit = nat_read_miss = data_read_hit = data_read_miss = 0;
+	
 #ifdef TIME_COUNTER
-			tUsed = t_read_block * 1000000 / COUNTS_PER_SECOND;
-			printf("t_read_block: %d us.\r\n", tUsed);
-			tUsed = t_memory_copy * 1000000 / COUNTS_PER_SECOND;
-			printf("t_memory_copy: %d us.\r\n", tUsed);
-			tUsed = t_read_nat * 1000000 / COUNTS_PER_SECOND;
-			printf("t_read_nat: %d us.\r\n", tUsed);
-			tUsed = t_path_hash * 1000000 / COUNTS_PER_SECOND;
-			printf("t_path_hash: %d us.\r\n", tUsed);
-			tUsed = t_count_dentry * 1000000 / COUNTS_PER_SECOND;
-			printf("t_count_dentry: %d us.\r\n", tUsed);
-			tUsed = t_find_dentry * 1000000 / COUNTS_PER_SECOND;
-			printf("t_find_dentry: %d us.\r\n", tUsed);
-
-			// reset
-			t_read_block = 0;
-			t_memory_copy = 0;
-			t_read_nat = 0;
-			t_path_hash = 0;
-			t_count_dentry = 0;
-			t_find_dentry = 0;
+		tUsed = t_read_block * 1000000 / COUNTS_PER_SECOND;
+		printf("t_read_block: %d us.\r\n", tUsed);
+		tUsed = t_memory_copy * 1000000 / COUNTS_PER_SECOND;
+		printf("t_memory_copy: %d us.\r\n", tUsed);
+		tUsed = t_read_nat * 1000000 / COUNTS_PER_SECOND;
+		printf("t_read_nat: %d us.\r\n", tUsed);
+		tUsed = t_path_hash * 1000000 / COUNTS_PER_SECOND;
+		printf("t_path_hash: %d us.\r\n", tUsed);
+		tUsed = t_count_dentry * 1000000 / COUNTS_PER_SECOND;
+		printf("t_count_dentry: %d us.\r\n", tUsed);
+		tUsed = t_find_dentry * 1000000 / COUNTS_PER_SECOND;
+		printf("t_find_dentry: %d us.\r\n", tUsed);
+
+		// reset
+		t_read_block = 0;
+		t_memory_copy = 0;
+		t_read_nat = 0;
+		t_path_hash = 0;
+		t_count_dentry = 0;
+		t_find_dentry = 0;
 #endif
-			// return;
-			// ============== testing end ==================
-			
-			unsigned int blk_addr, blk_num;
-			retrieve_address(file_ino, &blk_addr, &blk_num);
-			
-			analysisTask(blk_addr, blk_num);
-		}
-		else {
-			index += 20;  // 16*sizeof(char) + sizeof(int)
-			struct addressBlock* content = (struct addressBlock*)index;
-			while(1){
-				analysisTask(content->blockAddr, content->blockNum);
-				if(content->endFlag){
-					content ++;
-					break;
-				}
-				else
-					content ++;
+		// return;
+		// ============== testing end ==================
+		
+		unsigned int blk_addr, blk_num;
+		unsigned long long file_size = get_file_size(file_ino);
+		retrieve_address(file_ino, &blk_addr, &blk_num);
+		setSearchWindow(window, file_size);
+		
+		searchTask->jobSec = blk_addr;
+		searchTask->jobNlb = blk_num;
+		searchTask->jobOffset = 0;
+		searchTask->jobExtent = 0;
+		if(window->flags & SEARCH_WINDOW_INCREMENTAL){
+			if(!continueTail(file_ino, blk_addr, file_size)){
+				abort_task();
+				xil_printf("[StartSearchTask] the incremental task has no prepared query, this task is terminated.\r\n");
+				return 0;
 			}
 		}
-		
-		// searchTask->taskValid = 0;
-		// set_auto_nvme_cpl(searchTask->cmdSlotTag, 0x0, 0x0);
+		else if(checkResultCache(file_ino, get_inode_blkaddr(file_ino), blk_addr, blk_num, config, patternSize, window))
+			searchTask->jobNlb = 0;  // the same task over the same file is cached, nothing to read
+	}
+	else {
+		unsigned int extentNum = *((unsigned int *)index);
+		index += 4;
+		// the extents may span all the units of the config, a count past its end means the host cut the list
+		if (extentNum == 0 || extentNum > (configEnd - index) / sizeof(struct addressBlock)){
+			abort_task();
+			xil_printf("[StartSearchTask] %d extents do not fit in the %d units of the task config, this task is terminated.\r\n", extentNum, searchTask->configUnit);
+			return 0;
+		}
+		if(window->flags & SEARCH_WINDOW_INCREMENTAL){  // the tails are kept per inode
+			searchTask->failStatus = INVALID_FIELD_IN_COMMAND;
+			abort_task();
+			xil_printf("[StartSearchTask] an incremental task has to be given a path, this task is terminated.\r\n");
+			return 0;
+		}
+		setSearchWindow(window, window->fileSize);
+		searchTask->jobNlb = 0;  // the extents are in file order
+		searchTask->jobOffset = 0;
+		searchTask->jobExtent = (struct addressBlock*)index;
+		searchTask->jobExtentNum = extentNum;
+	}
+	
+	// searchTask->taskValid = 0;
+	// set_auto_nvme_cpl(searchTask->cmdSlotTag, 0x0, 0x0);
+
+	searchTask->jobState = SEARCH_JOB_RUN;
+	return 1;
+}
 
-		return 1;
+// the config of the selected task may have arrived, start the task, a background job only completes its command with the job id
+static int CheckTaskConfigDMA(){
+	if(check_auto_rx_dma_partial_done(searchTask->rxDmaTail, searchTask->rxDmaOverFlowCnt)){
+		searchTask->rxDmaExe = 0;
+
+		if(searchTask->background && searchTask->stopped){  // cancelled before its config was in
+			NVME_COMPLETION nvmeCPL;
+
+			nvmeCPL.dword[0] = 0x0;
+			nvmeCPL.statusField.SC = COMMAND_ABORT_REQUESTED;
+			set_auto_nvme_cpl(searchTask->cmdSlotTag, 0x0, nvmeCPL.statusFieldWord);
+			searchTask->taskValid = 0;
+			return 0;
+		}
+		if(searchTask->prepare){  // the config is a pattern set, the command completes with the handle of the query
+			NVME_COMPLETION nvmeCPL;
+			unsigned int handle = prepareQuery((char*)(DMA_TASK_CONFIG_ADDR + searchTask->taskId * SEARCH_CONFIG_MAX_UNIT * 4096));
+
+			nvmeCPL.dword[0] = 0x0;
+			if(handle == SEARCH_QUERY_NONE)
+				nvmeCPL.statusField.SC = INVALID_FIELD_IN_COMMAND;
+			set_auto_nvme_cpl(searchTask->cmdSlotTag, handle, nvmeCPL.statusFieldWord);
+			searchTask->taskValid = 0;
+			return 0;
+		}
+		if(searchTask->background){
+			searchTask->jobState = SEARCH_JOB_WAIT;
+			set_auto_nvme_cpl(searchTask->cmdSlotTag, searchTask->taskId, 0x0);
+			return 0;
+		}
+		return StartSearchTask();
 	}
 	return 0;
 }
 
+int CheckSearchTaskConfigDMA(){
+	static unsigned int busy;  // the path walk of a task reads the flash, which runs the scheduler again
+	unsigned int taskId, prev;
+	int started = 0;
+
+	if(busy)
+		return 0;
+
+	busy = 1;
+	for(taskId = 0; taskId < SEARCH_TASK_NUM; taskId++)
+		if(searchTaskTable[taskId].taskValid && searchTaskTable[taskId].rxDmaExe)
+		{
+			prev = selectSearchTask(taskId);
+			started |= CheckTaskConfigDMA();
+			selectSearchTask(prev);
+		}
+	busy = 0;
+
+	return started;
+}
+
+static unsigned int SearchReqNum(int chNo, int wayNo)
+{
+	unsigned int num = 0;
+	unsigned int entry;
+
+	for(entry = rqPointer->rqPointerEntry[chNo][wayNo].front; entry != rqPointer->rqPointerEntry[chNo][wayNo].rear; entry = (entry + 1) % REQ_QUEUE_DEPTH)
+		num += reqQueue->reqEntry[entry][chNo][wayNo].search;
+
+	return num;
+}
+
 void PushToReqQueue(P_LOW_LEVEL_REQ_INFO lowLevelCmd)
 {
 	int rear;
 	unsigned int phyRowAddr;
 	unsigned int chNo = lowLevelCmd->chNo;
 	unsigned int wayNo = lowLevelCmd->wayNo;
+
+	if(lowLevelCmd->request < LLSCommand_RxDMA && lowLevelCmd->search)
+	{
+		// the search reads only take QOS_SEARCH_REQ_MAX entries so that a host read finds room
+		if(SearchReqNum(chNo, wayNo) >= QOS_SEARCH_REQ_MAX)
+			qosCounter.searchHeld++;
+		while(SearchReqNum(chNo, wayNo) >= QOS_SEARCH_REQ_MAX)
+			ExeLowLevelReq(SUB_REQ_QUEUE);
+	}
+	else
+	{
+		markHostBusy();  // the background jobs wait until the dies are idle
+		if(((rqPointer->rqPointerEntry[chNo][wayNo].rear + 1) % REQ_QUEUE_DEPTH) == rqPointer->rqPointerEntry[chNo][wayNo].front)
+			qosCounter.hostFull++;
+	}
+
 	while(((rqPointer->rqPointerEntry[chNo][wayNo].rear + 1) % REQ_QUEUE_DEPTH) == rqPointer->rqPointerEntry[chNo][wayNo].front)
 		ExeLowLevelReq(SUB_REQ_QUEUE);
 
@@ -249,8 +369,11 @@ void PushToReqQueue(P_LOW_LEVEL_REQ_INFO lowLevelCmd)
 			assert(!"[WARNING] Unsupported bit count [WARNING]");
 
 		reqQueue->reqEntry[rear][chNo][wayNo].rowAddr = phyRowAddr;
-		if(lowLevelCmd->search){  // for searching
-			reqQueue->reqEntry[rear][chNo][wayNo].pageDataBuf = SEARCH_PAGE_DATA_BUFFER_ADDR + (wayNo * 8 + chNo) * PAGE_SIZE;
+		if(lowLevelCmd->search){  // for searching, the staging slot is held until the page is computed
+			unsigned int slot = ndpAllocSlot(chNo, wayNo);
+
+			reqQueue->reqEntry[rear][chNo][wayNo].searchSlot = slot;
+			reqQueue->reqEntry[rear][chNo][wayNo].pageDataBuf = SEARCH_PAGE_DATA_BUFFER_ADDR + ((wayNo * CHANNEL_NUM + chNo) * NDP_SLOT_NUM + slot) * PAGE_SIZE;
 		}
 		else{  // normal operation
 			reqQueue->reqEntry[rear][chNo][wayNo].bufferEntry = lowLevelCmd->bufferEntry;
@@ -261,12 +384,89 @@ void PushToReqQueue(P_LOW_LEVEL_REQ_INFO lowLevelCmd)
 		reqQueue->reqEntry[rear][chNo][wayNo].request = lowLevelCmd->request;
 
 		reqQueue->reqEntry[rear][chNo][wayNo].search = lowLevelCmd->search;
+		reqQueue->reqEntry[rear][chNo][wayNo].searchTaskId = lowLevelCmd->searchTaskId;
 		// reqQueue->reqEntry[rear][chNo][wayNo].searchBufferEntry = lowLevelCmd->searchBufferEntry;
 		reqQueue->reqEntry[rear][chNo][wayNo].searchPageIndex = lowLevelCmd->searchPageIndex;
+		reqQueue->reqEntry[rear][chNo][wayNo].searchLpn = lowLevelCmd->searchLpn;
+		reqQueue->reqEntry[rear][chNo][wayNo].searchStart = lowLevelCmd->searchStart;
+		reqQueue->reqEntry[rear][chNo][wayNo].searchEnd = lowLevelCmd->searchEnd;
+		reqQueue->reqEntry[rear][chNo][wayNo].searchOffset = lowLevelCmd->searchOffset;
+		reqQueue->reqEntry[rear][chNo][wayNo].searchRiders = 0;
 		rqPointer->rqPointerEntry[chNo][wayNo].rear = (rear + 1) % REQ_QUEUE_DEPTH;
 	}
 }
 
+// drop the search entries of the task that are not issued yet, the front entry of a die may be in flight so it is kept.
+// An entry another task rides on is handed over to that task, and the task's own riders are dropped too
+unsigned int CancelSearchReq(unsigned int taskId)
+{
+	unsigned int chNo, wayNo, dropped = 0;
+	struct ndpRider owner;
+
+	for(chNo = 0; chNo < CHANNEL_NUM; chNo++)
+		for(wayNo = 0; wayNo < WAY_NUM; wayNo++)
+		{
+			int front = rqPointer->rqPointerEntry[chNo][wayNo].front;
+			int rear = rqPointer->rqPointerEntry[chNo][wayNo].rear;
+			int src, dst;
+
+			if(front == rear)
+				continue;
+
+			src = dst = (front + 1) % REQ_QUEUE_DEPTH;
+			while(src != rear)
+			{
+				struct reqEntry* entry = &reqQueue->reqEntry[src][chNo][wayNo];
+				int drop = 0;
+
+				if(entry->search)
+				{
+					dropped += ndpDropRiders(&entry->searchRiders, taskId);
+					if(entry->searchTaskId == taskId)
+					{
+						dropped++;
+						drop = !ndpPromoteRider(&entry->searchRiders, &owner);
+						if(drop)
+							ndpReleaseSlot(chNo, wayNo, entry->searchSlot);
+						else
+						{
+							entry->searchTaskId = owner.taskId;
+							entry->searchPageIndex = owner.pageIndex;
+							entry->searchStart = owner.searchStart;
+							entry->searchEnd = owner.searchEnd;
+							entry->searchOffset = owner.offset;
+						}
+					}
+				}
+				if(!drop)
+				{
+					if(dst != src)
+						reqQueue->reqEntry[dst][chNo][wayNo] = reqQueue->reqEntry[src][chNo][wayNo];
+					dst = (dst + 1) % REQ_QUEUE_DEPTH;
+				}
+				src = (src + 1) % REQ_QUEUE_DEPTH;
+			}
+			rqPointer->rqPointerEntry[chNo][wayNo].rear = dst;
+		}
+
+	return dropped;
+}
+
+// the search read of the lpn that is queued and not transferred yet, NULL if there is none
+struct reqEntry* FindSearchReq(unsigned int lpn)
+{
+	unsigned int dieNo = lpn % DIE_NUM;
+	unsigned int chNo = dieNo % CHANNEL_NUM;
+	unsigned int wayNo = dieNo / CHANNEL_NUM;
+	unsigned int entry;
+
+	for(entry = rqPointer->rqPointerEntry[chNo][wayNo].front; entry != rqPointer->rqPointerEntry[chNo][wayNo].rear; entry = (entry + 1) % REQ_QUEUE_DEPTH)
+		if(reqQueue->reqEntry[entry][chNo][wayNo].search && reqQueue->reqEntry[entry][chNo][wayNo].searchLpn == lpn)
+			return &reqQueue->reqEntry[entry][chNo][wayNo];
+
+	return 0;
+}
+
 int CheckDMA(int chNo, int wayNo)
 {
 	int front = rqPointer->rqPointerEntry[chNo][wayNo].front;
@@ -667,6 +867,30 @@ int CheckSubReqErrorInfo(int chNo, int wayNo)
 	return EI_FAIL;
 }
 
+// the transfer of a search read is done, hand the page to the pipeline of its task and of the tasks riding on it
+static void QueueSearchPage(int chNo, int wayNo, int front)
+{
+	struct reqEntry* entry = &reqQueue->reqEntry[front][chNo][wayNo];
+
+	ndpQueuePage(chNo, wayNo, entry->searchSlot, entry->searchTaskId, entry->pageDataBuf, entry->searchPageIndex,
+			entry->searchStart, entry->searchEnd, entry->searchOffset, entry->searchLpn, entry->searchRiders);
+	entry->searchRiders = 0;
+}
+
+// the retries of a search read are used up, its task reads the page again later or reports it as unreadable
+static void FailSearchReq(int chNo, int wayNo, int front)
+{
+	struct reqEntry* entry = &reqQueue->reqEntry[front][chNo][wayNo];
+
+	if(entry->search)
+	{
+		failSearchPage(entry->searchTaskId, entry->searchLpn, entry->searchPageIndex, entry->searchStart, entry->searchEnd, entry->searchOffset);
+		ndpFailRiders(entry->searchRiders, entry->searchLpn);
+		entry->searchRiders = 0;
+		ndpReleaseSlot(chNo, wayNo, entry->searchSlot);
+	}
+}
+
 int ExeLowLevelReqPerDie(int chNo, int wayNo, int reqStatus)
 {
 	int front, tempLun, tempRowAddr, blockNo, entry, completion;
@@ -699,7 +923,7 @@ int ExeLowLevelReqPerDie(int chNo, int wayNo, int reqStatus)
 				else if(reqQueue->reqEntry[front][chNo][wayNo].request == V2FCommand_ReadPageTransfer && reqQueue->reqEntry[front][chNo][wayNo].search)
 				{
 					// xil_printf("read data done.\r\n");
-					searchInPage(reqQueue->reqEntry[front][chNo][wayNo].pageDataBuf, reqQueue->reqEntry[front][chNo][wayNo].searchPageIndex);
+					QueueSearchPage(chNo, wayNo, front);
 
 					rqPointer->rqPointerEntry[chNo][wayNo].front = (rqPointer->rqPointerEntry[chNo][wayNo].front + 1) % REQ_QUEUE_DEPTH;
 				}
@@ -730,6 +954,7 @@ int ExeLowLevelReqPerDie(int chNo, int wayNo, int reqStatus)
 					completion = completeTable->completeEntry[chNo][wayNo];
 
 					xil_printf("DS_EXE Request %d Fail - ch %d way %d rowAddr %x / status %x \r\n",reqQueue->reqEntry[front][chNo][wayNo].request, chNo, wayNo, reqQueue->reqEntry[front][chNo][wayNo].rowAddr, completion);
+					FailSearchReq(chNo, wayNo, front);
 
 					rqPointer->rqPointerEntry[chNo][wayNo].front = (rqPointer->rqPointerEntry[chNo][wayNo].front + 1) % REQ_QUEUE_DEPTH;
 					dieStatusTable->dieStatusEntry[chNo][wayNo].dieStatus = DS_IDLE;
@@ -743,6 +968,8 @@ int ExeLowLevelReqPerDie(int chNo, int wayNo, int reqStatus)
 				blockNo = tempLun * MAX_BLOCK_NUM_PER_LUN + tempRowAddr / PAGE_NUM_PER_MLC_BLOCK;
 
 				xil_printf("RS_WARNING - bad block manage [chNo %x wayNo %x phyBlock %x Rowaddr %x]\r\n",chNo, wayNo, blockNo, reqQueue->reqEntry[front][chNo][wayNo].rowAddr);
+				if(reqQueue->reqEntry[front][chNo][wayNo].search)  // the data was corrected, the page is searched all the same
+					QueueSearchPage(chNo, wayNo, front);
 
 				for(entry=0; entry<REQ_QUEUE_DEPTH; ++entry)
 				{
@@ -793,6 +1020,7 @@ int ExeLowLevelReqPerDie(int chNo, int wayNo, int reqStatus)
 					completion = completeTable->completeEntry[chNo][wayNo];
 
 					xil_printf("DS_TR_REEXE Request %d Fail - ch %d way %d rowAddr %x / status %x \r\n",reqQueue->reqEntry[front][chNo][wayNo].request, chNo, wayNo, reqQueue->reqEntry[front][chNo][wayNo].rowAddr, completion);
+					FailSearchReq(chNo, wayNo, front);
 
 					rqPointer->rqPointerEntry[chNo][wayNo].front = (rqPointer->rqPointerEntry[chNo][wayNo].front + 1) % REQ_QUEUE_DEPTH;
 					dieStatusTable->dieStatusEntry[chNo][wayNo].dieStatus = DS_IDLE;
@@ -816,7 +1044,11 @@ int ExeLowLevelReqPerDie(int chNo, int wayNo, int reqStatus)
 				if(reqQueue->reqEntry[front][chNo][wayNo].request == V2FCommand_ReadPageTrigger)
 					reqQueue->reqEntry[front][chNo][wayNo].request = V2FCommand_ReadPageTransfer;
 				else
+				{
+					if(reqQueue->reqEntry[front][chNo][wayNo].request == V2FCommand_ReadPageTransfer && reqQueue->reqEntry[front][chNo][wayNo].search)
+						QueueSearchPage(chNo, wayNo, front);  // the transfer succeeded on a retry
 					rqPointer->rqPointerEntry[chNo][wayNo].front = (rqPointer->rqPointerEntry[chNo][wayNo].front + 1) % REQ_QUEUE_DEPTH;
+				}
 
 				dieStatusTable->dieStatusEntry[chNo][wayNo].dieStatus = DS_IDLE;
 			}
@@ -842,6 +1074,7 @@ int ExeLowLevelReqPerDie(int chNo, int wayNo, int reqStatus)
 					completion = completeTable->completeEntry[chNo][wayNo];
 
 					xil_printf("DS_REEXE Request %d Fail - ch %d way %d rowAddr %x / status %x \r\n",reqQueue->reqEntry[front][chNo][wayNo].request, chNo, wayNo, reqQueue->reqEntry[front][chNo][wayNo].rowAddr, completion);
+					FailSearchReq(chNo, wayNo, front);
 
 					rqPointer->rqPointerEntry[chNo][wayNo].front = (rqPointer->rqPointerEntry[chNo][wayNo].front + 1) % REQ_QUEUE_DEPTH;
 					dieStatusTable->dieStatusEntry[chNo][wayNo].dieStatus = DS_IDLE;
@@ -855,6 +1088,8 @@ int ExeLowLevelReqPerDie(int chNo, int wayNo, int reqStatus)
 				blockNo = tempLun * MAX_BLOCK_NUM_PER_LUN + tempRowAddr / PAGE_NUM_PER_MLC_BLOCK;
 
 				xil_printf("RS_WARNING - bad block manage [chNo %x wayNo %x phyBlock %x Rowaddr %x]\r\n",chNo, wayNo, blockNo, reqQueue->reqEntry[front][chNo][wayNo].rowAddr);
+				if(reqQueue->reqEntry[front][chNo][wayNo].search)  // the data was corrected, the page is searched all the same
+					QueueSearchPage(chNo, wayNo, front);
 
 				for(entry=0; entry<REQ_QUEUE_DEPTH; ++entry)
 				{
@@ -1178,6 +1413,51 @@ void LinkToNandErase(unsigned int chNo, unsigned int wayNo)
 	若firstQueue空,则参照secondQueue;
 	若secondQueue也空,则将此way标记为idle
 */
+// a host read (its trigger or its transfer to the host) never changes the flash, so it may go ahead of the search reads.
+// The programs and the DMA of the writes keep their place, so a search read is served before the ones queued after it.
+static int HostReadEntry(struct reqEntry* entry)
+{
+	return !entry->search && ((entry->request == V2FCommand_ReadPageTrigger) || (entry->request == LLSCommand_TxDMA));
+}
+
+// a search read waiting at the front of an idle die lets the first host entry behind it go first if it is a host read,
+// QOS_HOST_QUANTUM times in a row, then it goes itself. The host entries keep their order and a search read already
+// triggered is never moved.
+static void ArbitrateReqQueue(int chNo, int wayNo)
+{
+	int front = rqPointer->rqPointerEntry[chNo][wayNo].front;
+	int rear = rqPointer->rqPointerEntry[chNo][wayNo].rear;
+	int entry, prev;
+	struct reqEntry hostEntry;
+
+	if((front == rear) || !reqQueue->reqEntry[front][chNo][wayNo].search || (reqQueue->reqEntry[front][chNo][wayNo].request != V2FCommand_ReadPageTrigger)
+			|| (dieStatusTable->dieStatusEntry[chNo][wayNo].dieStatus != DS_IDLE))
+		return;
+
+	entry = (front + 1) % REQ_QUEUE_DEPTH;
+	while((entry != rear) && reqQueue->reqEntry[entry][chNo][wayNo].search)
+		entry = (entry + 1) % REQ_QUEUE_DEPTH;
+
+	// no host entry waits, it is not a read, or the search read's turn
+	if((entry == rear) || !HostReadEntry(&reqQueue->reqEntry[entry][chNo][wayNo]) || (hostAhead[chNo][wayNo] >= QOS_HOST_QUANTUM))
+	{
+		hostAhead[chNo][wayNo] = 0;
+		return;
+	}
+
+	hostEntry = reqQueue->reqEntry[entry][chNo][wayNo];
+	while(entry != front)
+	{
+		prev = (entry + REQ_QUEUE_DEPTH - 1) % REQ_QUEUE_DEPTH;
+		reqQueue->reqEntry[entry][chNo][wayNo] = reqQueue->reqEntry[prev][chNo][wayNo];
+		entry = prev;
+	}
+	reqQueue->reqEntry[front][chNo][wayNo] = hostEntry;
+
+	hostAhead[chNo][wayNo]++;
+	qosCounter.searchDeferred++;
+}
+
 void FindPriorityTable(int chNo, int wayNo, int firstQueue)
 {
 	unsigned int request, empty;
@@ -1201,6 +1481,7 @@ void FindPriorityTable(int chNo, int wayNo, int firstQueue)
 		else
 		{
 			dieStatusTable->dieStatusEntry[chNo][wayNo].queueSelect = REQ_QUEUE;
+			ArbitrateReqQueue(chNo, wayNo);
 			request = reqQueue->reqEntry[rqPointer->rqPointerEntry[chNo][wayNo].front][chNo][wayNo].request;
 		}
 	}
@@ -1218,6 +1499,7 @@ void FindPriorityTable(int chNo, int wayNo, int firstQueue)
 				LinkToIdle(chNo, wayNo);  //mark this way IDLE
 				return;
 			}
+			ArbitrateReqQueue(chNo, wayNo);
 			request = reqQueue->reqEntry[rqPointer->rqPointerEntry[chNo][wayNo].front][chNo][wayNo].request;  //ReqQueue not empty,take the front entry's request
 		}
 		else  //SubReqQueue not empty
@@ -1291,8 +1573,7 @@ int ExeLowLevelReqPerCh(int chNo, int firstQueue)  //执行此Channel的队列
 		}
 
 		if(idleWay == WAY_NUM){
-			if(searchTask->taskValid && searchTask->rxDmaExe)
-				CheckSearchTaskConfigDMA();
+			CheckSearchTaskConfigDMA();
 			return 0;
 		}
 	}
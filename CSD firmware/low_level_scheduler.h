@@ -77,6 +77,10 @@
 
 
 #define REQ_QUEUE_DEPTH	16
+
+// QoS between the host I/O and the search reads sharing a reqQueue
+#define QOS_HOST_QUANTUM	4  // host reads let ahead of the search read waiting at the front of a die before that read goes
+#define QOS_SEARCH_REQ_MAX	(REQ_QUEUE_DEPTH - 4)  // search entries admitted to the reqQueue of a die, the other slots are kept for the host
 #define SUB_REQ_QUEUE_DEPTH	(PAGE_NUM_PER_BLOCK * 2)
 
 //ECC error information
@@ -140,7 +144,14 @@ struct reqEntry {
 
 	unsigned int search : 1;  // to judge whether this entry is a regular or a search entry
 	unsigned int searchBufferEntry : 8;  // identifies the buffer entry to which this entry belongs
+	unsigned int searchSlot : 8;  // the staging slot of the die holding the page until it is computed
+	unsigned int searchTaskId : 8;  // the slot of the task table the page belongs to
 	unsigned int searchPageIndex;
+	unsigned int searchLpn;  // to read the page again if the read fails
+	unsigned int searchStart : 16;  // the bytes [searchStart, searchEnd) of the page belong to the search
+	unsigned int searchEnd : 16;
+	unsigned long long searchOffset;  // file offset of searchStart
+	unsigned short searchRiders;  // index+1 of the first ndpRider, the pages of other tasks sharing this read
 
 	unsigned int reserved : 23;
 };
@@ -227,8 +238,21 @@ struct wayPriorityArray {
 	struct wayPriorityEntry wayPriorityEntry[CHANNEL_NUM];
 };
 
+// how much each class was throttled, read with Get Features 0x15
+struct qosCounter {
+	unsigned int searchDeferred;  // times a search read at the front of a die let a host entry go first
+	unsigned int searchHeld;  // search pushes that waited for QOS_SEARCH_REQ_MAX
+	unsigned int hostFull;  // host pushes that waited for a full reqQueue
+	unsigned int searchShared;  // search pages that rode on the read of another page instead of reading the flash
+};
+
+extern struct qosCounter qosCounter;
+
 int CheckSearchTaskConfigDMA();
+int StartSearchTask();
 void PushToReqQueue(P_LOW_LEVEL_REQ_INFO lowLevelCmd);
+unsigned int CancelSearchReq(unsigned int taskId);
+struct reqEntry* FindSearchReq(unsigned int lpn);
 int PopFromReqQueue(int chNo, int wayNo);
 int CheckReqStatusAsync(int chNo, int wayNo);
 int CheckReqErrorInfo(int chNo, int wayNo);
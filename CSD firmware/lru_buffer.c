@@ -374,6 +374,7 @@ void LRUBufWrite(P_HOST_REQ_INFO hostCmd)
 	counter = 0;
 	dmaIndex = 0;
 	tempLpn = hostCmd->curSect / SECTOR_NUM_PER_PAGE;
+	cacheSnoopWrite(hostCmd->curSect, hostCmd->reqSect);  // the cached results of a file written in place are stale
 
 	hitEntry = CheckBufHit(tempLpn);
 	if(hitEntry != 0x7fff)  //hit
@@ -0,0 +1,539 @@
+/**
+ * @file match.c
+ * @author Lin Li
+ * @brief pattern matching engines used by the in-storage search. Nothing in
+ * this file touches the hardware, so it can also be built on the host.
+ *
+ * @copyright Copyright (c) 2023 Chongqing University StarLab
+ *
+ */
+#include <string.h>
+#include "match.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MATCH_USE_NEON
+#endif
+
+static unsigned short acQueue[AC_MAX_STATE_NUM];  // BFS order used while folding the failure links
+
+static unsigned char foldAscii[256];  // the lower case of every byte
+static unsigned short foldUtf8[2048];  // the folded code point of every 2-byte UTF-8 code point
+static int foldReady;
+
+// simple case folding of the letters encoded in 2 bytes, the folded letter also takes 2 bytes.
+// Latin-1, Latin Extended-A, the regular pairs of Latin Extended-B, Greek, Cyrillic and Armenian
+static unsigned int foldCodePoint(unsigned int cp){
+    if (cp == 0xb5)
+        return 0x3bc;  // micro sign
+    if (cp >= 0xc0 && cp <= 0xde && cp != 0xd7)
+        return cp + 0x20;  // Latin-1
+    if ((cp >= 0x100 && cp <= 0x12f) || (cp >= 0x132 && cp <= 0x137) || (cp >= 0x14a && cp <= 0x177) ||
+        (cp >= 0x1de && cp <= 0x1ef) || (cp >= 0x1f8 && cp <= 0x21f) || (cp >= 0x222 && cp <= 0x233))
+        return cp | 1;  // Latin Extended-A/B, the upper case is even
+    if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17e) || (cp >= 0x1cd && cp <= 0x1dc))
+        return cp + (cp & 1);  // the upper case is odd
+    if (cp == 0x178)
+        return 0xff;
+    if (cp == 0x386)
+        return 0x3ac;  // Greek
+    if (cp >= 0x388 && cp <= 0x38a)
+        return cp + 0x25;
+    if (cp == 0x38c)
+        return 0x3cc;
+    if (cp == 0x38e || cp == 0x38f)
+        return cp + 0x3f;
+    if (cp >= 0x391 && cp <= 0x3ab && cp != 0x3a2)
+        return cp + 0x20;
+    if (cp == 0x3c2)
+        return 0x3c3;  // final sigma
+    if ((cp >= 0x3d8 && cp <= 0x3ef) || (cp >= 0x460 && cp <= 0x481) || (cp >= 0x48a && cp <= 0x4bf) || (cp >= 0x4d0 && cp <= 0x52f))
+        return cp | 1;  // Greek and Cyrillic pairs
+    if (cp >= 0x400 && cp <= 0x40f)
+        return cp + 0x50;  // Cyrillic
+    if (cp >= 0x410 && cp <= 0x42f)
+        return cp + 0x20;
+    if (cp == 0x4c0)
+        return 0x4cf;
+    if (cp >= 0x4c1 && cp <= 0x4ce)
+        return cp + (cp & 1);
+    if (cp >= 0x531 && cp <= 0x556)
+        return cp + 0x30;  // Armenian
+    return cp;
+}
+
+static void fold_init(){
+    if (foldReady)
+        return;
+    for (unsigned int c = 0; c < 256; c++)
+        foldAscii[c] = (c >= 'A' && c <= 'Z') ? c + 0x20 : c;
+    for (unsigned int cp = 0; cp < 2048; cp++)
+        foldUtf8[cp] = foldCodePoint(cp);
+    foldReady = 1;
+}
+
+// a 2-byte UTF-8 character starts at data[i], it is folded if its continuation byte is in the buffer
+static inline int fold_is_pair(const unsigned char *data, unsigned int i, unsigned int len){
+    return data[i] >= 0xc2 && data[i] <= 0xdf && i + 1 < len && (data[i + 1] & 0xc0) == 0x80;
+}
+
+// fold len bytes of a pattern the way the text is folded while scanning
+static void fold_buffer(unsigned char *dst, const unsigned char *src, unsigned int len, unsigned int fold){
+    for (unsigned int i = 0; i < len; i++){
+        if ((fold & MATCH_FOLD_UTF8) && fold_is_pair(src, i, len)){
+            unsigned int cp = foldUtf8[((src[i] & 0x1f) << 6) | (src[i + 1] & 0x3f)];
+            dst[i] = 0xc0 | (cp >> 6);
+            dst[++i] = 0x80 | (cp & 0x3f);
+        }
+        else
+            dst[i] = fold ? foldAscii[src[i]] : src[i];
+    }
+}
+
+/**
+ * @brief compile the pattern set into an Aho-Corasick automaton with a full
+ * goto table, so that scanning costs one table lookup per byte. The patterns
+ * are folded first if fold is set, the upper case ASCII letters then share
+ * the transitions of the lower case ones.
+ *
+ * @return 0 on success, 1 if the pattern set is empty or does not fit.
+ */
+int ac_build(struct acAutomaton *ac, char patterns[][MAX_PATTERN_LEN], unsigned int patternNum, unsigned int fold){
+    unsigned int p, i, c, head, tail;
+    unsigned char folded[MAX_PATTERN_LEN];
+
+    if (patternNum == 0 || patternNum > MAX_PATTERN_NUM)
+        return 1;
+
+    fold_init();
+    memset(&ac->state[AC_ROOT], 0, sizeof(struct acState));
+    ac->stateNum = 1;
+    ac->patternNum = patternNum;
+    ac->fold = fold;
+
+    // 1. build the trie, next[] == AC_ROOT means "no edge" for now
+    for (p = 0; p < patternNum; p++){
+        unsigned int len = strnlen(patterns[p], MAX_PATTERN_LEN - 1);
+        unsigned int s = AC_ROOT;
+
+        if (len == 0)
+            return 1;
+        ac->patternLen[p] = len;
+        fold_buffer(folded, (const unsigned char *)patterns[p], len, fold);
+
+        for (i = 0; i < len; i++){
+            c = folded[i];
+            if (ac->state[s].next[c] == AC_ROOT){
+                if (ac->stateNum >= AC_MAX_STATE_NUM)
+                    return 1;
+                memset(&ac->state[ac->stateNum], 0, sizeof(struct acState));
+                ac->state[s].next[c] = ac->stateNum++;
+            }
+            s = ac->state[s].next[c];
+        }
+
+        ac->outputList[p].patternId = p;
+        ac->outputList[p].next = ac->state[s].output;
+        ac->state[s].output = p + 1;
+    }
+
+    // 2. BFS, fold the failure function into next[] and set up the dictionary links
+    head = tail = 0;
+    for (c = 0; c < 256; c++){
+        unsigned int s = ac->state[AC_ROOT].next[c];
+        if (s != AC_ROOT){
+            ac->state[s].fail = AC_ROOT;
+            ac->state[s].dictLink = AC_ROOT;
+            acQueue[tail++] = s;
+        }
+    }
+
+    while (head < tail){
+        unsigned int r = acQueue[head++];
+
+        for (c = 0; c < 256; c++){
+            unsigned int s = ac->state[r].next[c];
+            unsigned int f = ac->state[ac->state[r].fail].next[c];
+
+            if (s != AC_ROOT){
+                ac->state[s].fail = f;
+                ac->state[s].dictLink = ac->state[f].output ? f : ac->state[f].dictLink;
+                acQueue[tail++] = s;
+            }
+            else
+                ac->state[r].next[c] = f;
+        }
+    }
+
+    if (fold)
+        for (unsigned int s = 0; s < ac->stateNum; s++)
+            for (c = 'A'; c <= 'Z'; c++)
+                ac->state[s].next[c] = ac->state[s].next[c + 0x20];
+
+    return 0;
+}
+
+// report every pattern that ends in state s at data[end], including the shorter suffixes
+static inline unsigned int ac_report(const struct acAutomaton *ac, unsigned int s, unsigned int end, unsigned int *hitCounts, matchHook hook){
+    unsigned int total = 0;
+
+    for (unsigned int t = ac->state[s].output ? s : ac->state[s].dictLink; t != AC_ROOT; t = ac->state[t].dictLink){
+        for (unsigned int o = ac->state[t].output; o; o = ac->outputList[o - 1].next){
+            unsigned int patternId = ac->outputList[o - 1].patternId;
+            hitCounts[patternId]++;
+            total++;
+            if (hook)
+                hook(end + 1 - ac->patternLen[patternId], patternId);
+        }
+    }
+
+    return total;
+}
+
+// ac_search() with MATCH_FOLD_UTF8, the 2-byte characters are folded on the fly
+static unsigned int ac_search_utf8(struct acAutomaton *ac, const unsigned char *data, unsigned int len, unsigned int *hitCounts, matchHook hook){
+    unsigned int s = AC_ROOT;
+    unsigned int total = 0;
+
+    for (unsigned int i = 0; i < len; i++){
+        unsigned int c = data[i];
+
+        if (fold_is_pair(data, i, len)){
+            unsigned int cp = foldUtf8[((c & 0x1f) << 6) | (data[i + 1] & 0x3f)];
+            s = ac->state[s].next[0xc0 | (cp >> 6)];
+            if (ac->state[s].output || ac->state[s].dictLink != AC_ROOT)
+                total += ac_report(ac, s, i, hitCounts, hook);
+            c = 0x80 | (cp & 0x3f);
+            i++;
+        }
+
+        s = ac->state[s].next[c];
+        if (ac->state[s].output || ac->state[s].dictLink != AC_ROOT)
+            total += ac_report(ac, s, i, hitCounts, hook);
+    }
+
+    return total;
+}
+
+/**
+ * @brief scan len bytes and accumulate the occurrences of every pattern into
+ * hitCounts[patternId]. Overlapping occurrences are all counted, and reported
+ * to hook if it is not NULL.
+ *
+ * @return the number of occurrences found in this call.
+ */
+unsigned int ac_search(struct acAutomaton *ac, const unsigned char *data, unsigned int len, unsigned int *hitCounts, matchHook hook){
+    unsigned int s = AC_ROOT;
+    unsigned int total = 0;
+
+    if (ac->fold & MATCH_FOLD_UTF8)
+        return ac_search_utf8(ac, data, len, hitCounts, hook);
+
+    for (unsigned int i = 0; i < len; i++){
+        s = ac->state[s].next[data[i]];
+
+        if (ac->state[s].output == 0 && ac->state[s].dictLink == AC_ROOT)
+            continue;
+        total += ac_report(ac, s, i, hitCounts, hook);
+    }
+
+    return total;
+}
+
+// find the position of temp in target.
+int Sunday_FindIndex(char *target,char temp){
+    for(int i = strlen(target) -1;i>=0;i--){
+        if(target[i] == temp)
+            return i;
+    }
+    return -1;  // failed to find
+}
+
+// the string search function, based on Sunday algorithm.
+unsigned int Sunday(char *source,char *target){
+    int i= 0,j = 0,srclen = 16384,tarlen=strlen(target);
+    int temp  = 0,index = -1;
+	int count = 0;
+
+    while(i < srclen){
+        if(source[i] == target[j]){
+            if(j == tarlen - 1){
+                i++; j=0; count++;  // match successfully
+            }
+			else{
+                i++;j++;
+            }	
+        }else{  // unequal positions found
+            temp = tarlen - j + i;  // the position of the first character after the source string
+            index = Sunday_FindIndex(target,source[temp]);
+            if(index==-1){ // not find the position, go forward
+                i = temp+1;
+                j = 0;
+            }else{  // find the position
+                i = temp-index;
+                j = 0;
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief build the shift table of the single-pattern kernel, once per task.
+ * Only MATCH_FOLD_ASCII is supported, the UTF-8 folding needs ac_search().
+ *
+ * @return 0 on success, 1 if the pattern is empty or too long.
+ */
+int sunday_build(struct sundayTable *table, const char *pattern, unsigned int fold){
+    unsigned int len = strnlen(pattern, MAX_PATTERN_LEN);
+
+    if (len == 0 || len >= MAX_PATTERN_LEN || (fold & MATCH_FOLD_UTF8))
+        return 1;
+
+    fold_init();
+    table->patternLen = len;
+    table->fold = fold;
+    fold_buffer(table->pattern, (const unsigned char *)pattern, len, fold);
+
+    // distance from the byte after the window to its last occurrence in the pattern
+    for (unsigned int c = 0; c < 256; c++)
+        table->shift[c] = len + 1;
+    for (unsigned int i = 0; i < len; i++)
+        table->shift[table->pattern[i]] = len - i;
+    if (fold)
+        for (unsigned int c = 'A'; c <= 'Z'; c++)
+            table->shift[c] = table->shift[c + 0x20];
+
+    return 0;
+}
+
+// compare n bytes of data with the pattern from its byte from, folding the data if needed
+static inline int sunday_equal(const struct sundayTable *table, const unsigned char *data, unsigned int from, unsigned int n){
+    if (!table->fold)
+        return memcmp(data, table->pattern + from, n) == 0;
+
+    for (unsigned int i = 0; i < n; i++)
+        if (foldAscii[data[i]] != table->pattern[from + i])
+            return 0;
+    return 1;
+}
+
+// scalar Sunday (quick search) with the precomputed shift table, counts overlapping occurrences
+static unsigned int sunday_scalar(const struct sundayTable *table, const unsigned char *data, unsigned int start, unsigned int len, matchHook hook){
+    unsigned int m = table->patternLen;
+    unsigned int i = start;
+    unsigned int count = 0;
+
+    while (i + m <= len){
+        if ((table->fold ? foldAscii[data[i]] : data[i]) == table->pattern[0] && sunday_equal(table, data + i + 1, 1, m - 1)){
+            count++;
+            if (hook)
+                hook(i, 0);
+        }
+
+        if (i + m == len)
+            break;
+        i += table->shift[data[i + m]];
+    }
+
+    return count;
+}
+
+#ifdef MATCH_USE_NEON
+// the lower case of the ASCII letters in 16 lanes
+static inline uint8x16_t fold_lanes(uint8x16_t v){
+    uint8x16_t upper = vcltq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8(26));
+    return vorrq_u8(v, vandq_u8(upper, vdupq_n_u8(0x20)));
+}
+#endif
+
+/**
+ * @brief count the (overlapping) occurrences of the task's single pattern in
+ * len bytes, reporting each of them to hook if it is not NULL. With NEON, 16 candidate positions are filtered at once by
+ * comparing their first and last bytes with the pattern, and only the
+ * surviving lanes are verified. The remaining tail and non-NEON builds fall
+ * back to the table-driven scalar kernel. With MATCH_FOLD_ASCII the data is
+ * folded as it is compared.
+ */
+unsigned int sunday_search(const struct sundayTable *table, const unsigned char *data, unsigned int len, matchHook hook){
+    unsigned int m = table->patternLen;
+    unsigned int i = 0;
+    unsigned int count = 0;
+
+    if (len < m)
+        return 0;
+
+#ifdef MATCH_USE_NEON
+    const uint8x16_t first = vdupq_n_u8(table->pattern[0]);
+    const uint8x16_t last = vdupq_n_u8(table->pattern[m - 1]);
+
+    for (; i + m - 1 + 16 <= len; i += 16){
+        uint8x16_t head = vld1q_u8(data + i), tail = vld1q_u8(data + i + m - 1);
+        if (table->fold){
+            head = fold_lanes(head);
+            tail = fold_lanes(tail);
+        }
+        uint8x16_t eq = vandq_u8(vceqq_u8(first, head), vceqq_u8(last, tail));
+        unsigned long long lo = vgetq_lane_u64(vreinterpretq_u64_u8(eq), 0);
+        unsigned long long hi = vgetq_lane_u64(vreinterpretq_u64_u8(eq), 1);
+
+        // each lane is 0x00 or 0xff, walk the set lanes of both halves
+        while (lo){
+            unsigned int lane = __builtin_ctzll(lo) >> 3;
+            if (m <= 2 || sunday_equal(table, data + i + lane + 1, 1, m - 2)){
+                count++;
+                if (hook)
+                    hook(i + lane, 0);
+            }
+            lo &= ~(0xffULL << (lane << 3));
+        }
+        while (hi){
+            unsigned int lane = __builtin_ctzll(hi) >> 3;
+            if (m <= 2 || sunday_equal(table, data + i + 8 + lane + 1, 1, m - 2)){
+                count++;
+                if (hook)
+                    hook(i + 8 + lane, 0);
+            }
+            hi &= ~(0xffULL << (lane << 3));
+        }
+    }
+#endif
+
+    return count + sunday_scalar(table, data, i, len, hook);
+}
+
+/**
+ * @brief build the masks of the approximate matcher, once per task. With
+ * MATCH_FOLD_ASCII both cases of a letter share its mask, MATCH_FOLD_UTF8 is
+ * not supported.
+ *
+ * @return 0 on success, 1 if the pattern is too long or not longer than k.
+ */
+int bitap_build(struct bitapTable *table, const char *pattern, unsigned int k, unsigned int fold){
+    unsigned int len = strnlen(pattern, BITAP_MAX_LEN);
+    unsigned char folded[BITAP_MAX_LEN];
+
+    if (len >= BITAP_MAX_LEN || len <= k || k > BITAP_MAX_K || (fold & MATCH_FOLD_UTF8))
+        return 1;
+
+    fold_init();
+    fold_buffer(folded, (const unsigned char *)pattern, len, fold);
+    table->patternLen = len;
+    table->k = k;
+    memset(table->mask, 0, sizeof(table->mask));
+    for (unsigned int i = 0; i < len; i++)
+        table->mask[folded[i]] |= 1u << i;
+    if (fold)
+        for (unsigned int c = 'A'; c <= 'Z'; c++)
+            table->mask[c] = table->mask[c + 0x20];
+
+    return 0;
+}
+
+/**
+ * @brief bit-parallel (Wu-Manber) approximate matching: R[d] bit i is set if
+ * pattern[0..i] matches a suffix of the text with at most d edits. A match is
+ * a run of consecutive end positions within k edits, counted at its first
+ * position if that is not before from. The state only depends on the last
+ * patternLen + k bytes, so the positions from there on are exact whatever
+ * came before the buffer.
+ *
+ * The hook gets the end of the run minus the pattern length as the start.
+ *
+ * @return the number of matches counted.
+ */
+unsigned int bitap_search(const struct bitapTable *table, const unsigned char *data, unsigned int len, unsigned int from, matchHook hook){
+    unsigned int R[BITAP_MAX_K + 1];
+    unsigned int m = table->patternLen, k = table->k;
+    unsigned int accept = 1u << (m - 1);
+    unsigned int count = 0, hit = 0;
+
+    for (unsigned int d = 0; d <= k; d++)
+        R[d] = (1u << d) - 1;
+
+    for (unsigned int i = 0; i < len; i++){
+        unsigned int B = table->mask[data[i]];
+        unsigned int old = R[0];
+
+        R[0] = ((R[0] << 1) | 1) & B;
+        for (unsigned int d = 1; d <= k; d++){
+            unsigned int tmp = R[d];
+            // match | substitution | insertion | deletion
+            R[d] = (((tmp << 1) | 1) & B) | ((old << 1) | 1) | old | (R[d - 1] << 1);
+            old = tmp;
+        }
+
+        if (R[k] & accept){
+            if (!hit && i >= from){
+                count++;
+                if (hook)
+                    hook(i + 1 >= m ? i + 1 - m : 0, 0);
+            }
+            hit = 1;
+        }
+        else
+            hit = 0;
+    }
+
+    return count;
+}
+
+/**
+ * @brief build the masked binary pattern, once per task. A data byte c matches
+ * pattern[i] if (c & mask[i]) == (pattern[i] & mask[i]), so the pattern can
+ * hold any byte (0x00 included) and wildcard bits.
+ *
+ * @return 0 on success, 1 if the pattern is empty or too long.
+ */
+int masked_build(struct maskedTable *table, const unsigned char *pattern, const unsigned char *mask, unsigned int len){
+    unsigned int first = 0;  // the positions before a wildcard byte do not shorten the shifts
+
+    if (len == 0 || len > BINARY_MAX_LEN)
+        return 1;
+
+    table->patternLen = len;
+    for (unsigned int i = 0; i < len; i++){
+        table->mask[i] = mask[i];
+        table->pattern[i] = pattern[i] & mask[i];
+        if (mask[i] == 0 && i + 1 < len)
+            first = i;
+    }
+
+    // distance from the last byte of the window to the last position of the pattern it can match
+    for (unsigned int c = 0; c < 256; c++)
+        table->shift[c] = (mask[first] == 0 && first + 1 < len) ? len - 1 - first : len;
+    for (unsigned int i = first; i + 1 < len; i++){
+        if (mask[i] == 0xff)
+            table->shift[table->pattern[i]] = len - 1 - i;
+        else
+            for (unsigned int c = 0; c < 256; c++)
+                if ((c & mask[i]) == table->pattern[i])
+                    table->shift[c] = len - 1 - i;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief count the (overlapping) occurrences of the masked pattern in len
+ * bytes with Horspool, reporting each of them to hook if it is not NULL. The
+ * window is verified from its last byte, the one the shift depends on.
+ */
+unsigned int masked_search(const struct maskedTable *table, const unsigned char *data, unsigned int len, matchHook hook){
+    unsigned int m = table->patternLen;
+    unsigned int count = 0;
+
+    for (unsigned int i = 0; i + m <= len; i += table->shift[data[i + m - 1]]){
+        int j = m - 1;
+
+        while (j >= 0 && (data[i + j] & table->mask[j]) == table->pattern[j])
+            j--;
+        if (j < 0){
+            count++;
+            if (hook)
+                hook(i, 0);
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file match.h
+ * @author Lin Li
+ * @brief pattern matching engines used by the in-storage search
+ *
+ * @copyright Copyright (c) 2023 Chongqing University StarLab
+ *
+ */
+#ifndef MATCH_H_
+#define MATCH_H_
+
+#define MAX_PATTERN_NUM 64  // patterns carried by one task
+#define MAX_PATTERN_LEN 16  // bytes per pattern slot in the task config, including '\0'
+
+#define BITAP_MAX_LEN 32  // bytes of the approximate pattern slot, including '\0'
+#define BITAP_MAX_K 8  // the most errors allowed by the approximate matcher
+
+#define BINARY_MAX_LEN 4096  // bytes of a masked binary pattern, no longer than a block so a match spans at most two pages
+
+// case folding modes of the engines
+#define MATCH_FOLD_ASCII 1  // the ASCII letters match in either case
+#define MATCH_FOLD_UTF8 2  // so do the 2-byte UTF-8 letters with a simple case folding, on top of MATCH_FOLD_ASCII
+
+#define AC_MAX_STATE_NUM (MAX_PATTERN_NUM * MAX_PATTERN_LEN)  // enough for the worst case pattern set
+#define AC_ROOT 0
+
+struct acState
+{
+    unsigned short next[256];  // full goto table, failure transitions are folded in
+    unsigned short fail;
+    unsigned short dictLink;  // nearest proper suffix state that ends a pattern, AC_ROOT if none
+    unsigned short output;  // index+1 of the first entry in outputList, 0 if no pattern ends here
+    unsigned short reserved;
+};
+
+struct acOutput
+{
+    unsigned short patternId;
+    unsigned short next;  // index+1 of the next pattern ending in the same state
+};
+
+struct acAutomaton
+{
+    unsigned int stateNum;
+    unsigned int patternNum;
+    unsigned int fold;  // MATCH_FOLD_UTF8 folds the text while scanning, MATCH_FOLD_ASCII is in the goto table
+    unsigned int patternLen[MAX_PATTERN_NUM];
+    struct acOutput outputList[MAX_PATTERN_NUM];
+    struct acState state[AC_MAX_STATE_NUM];
+};
+
+struct sundayTable
+{
+    unsigned int patternLen;
+    unsigned int fold;  // MATCH_FOLD_ASCII or 0, the pattern is stored folded
+    unsigned char pattern[MAX_PATTERN_LEN];
+    unsigned short shift[256];  // Sunday shift indexed by the byte right after the window
+};
+
+struct bitapTable
+{
+    unsigned int patternLen;
+    unsigned int k;  // the edit distance allowed
+    unsigned int mask[256];  // bit i is set if pattern[i] is the byte
+};
+
+struct maskedTable
+{
+    unsigned int patternLen;
+    unsigned short shift[256];  // Horspool shift indexed by the last byte of the window
+    unsigned char pattern[BINARY_MAX_LEN];  // already masked
+    unsigned char mask[BINARY_MAX_LEN];  // the bits of each byte that have to match, 0x00 for a wildcard byte
+};
+
+// called for every occurrence, pos is where it starts in the scanned buffer
+typedef void (*matchHook)(unsigned int pos, unsigned int patternId);
+
+int ac_build(struct acAutomaton *ac, char patterns[][MAX_PATTERN_LEN], unsigned int patternNum, unsigned int fold);
+unsigned int ac_search(struct acAutomaton *ac, const unsigned char *data, unsigned int len, unsigned int *hitCounts, matchHook hook);
+
+int Sunday_FindIndex(char *target, char temp);
+unsigned int Sunday(char *source, char *target);
+
+int sunday_build(struct sundayTable *table, const char *pattern, unsigned int fold);
+unsigned int sunday_search(const struct sundayTable *table, const unsigned char *data, unsigned int len, matchHook hook);
+
+int bitap_build(struct bitapTable *table, const char *pattern, unsigned int k, unsigned int fold);
+unsigned int bitap_search(const struct bitapTable *table, const unsigned char *data, unsigned int len, unsigned int from, matchHook hook);
+
+int masked_build(struct maskedTable *table, const unsigned char *pattern, const unsigned char *mask, unsigned int len);
+unsigned int masked_search(const struct maskedTable *table, const unsigned char *data, unsigned int len, matchHook hook);
+
+#endif
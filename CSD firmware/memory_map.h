@@ -65,11 +65,15 @@
 
 #include "lru_buffer.h"
 #include "page_map.h"
+#include "search.h"
 
 // Uncached & Unbuffered
+#define SEARCH_RESULT_ADDR             0xC000000  // 192MB, a region of SEARCH_RESULT_REGION_SIZE per task to store the results sent back to host
+#define SEARCH_RESULT_REGION_SIZE      0x100000   // 1MB, the 4KB units of the command after the config
+#define SEARCH_LOG_ADDR                0xC700000  // 199MB, 4KB per task for the header of its results log page
 #define DATA_SPACE_ADDR                0xC800000  // 200MB
-#define DMA_TASK_CONFIG_ADDR           0xFA00000  // 250MB, to store the config received from host
-#define SEARCH_PAGE_DATA_BUFFER_ADDR   0xFB00000  // 251MB, to store the page data read from flash
+#define DMA_TASK_CONFIG_ADDR           0xFA00000  // 250MB, SEARCH_CONFIG_MAX_UNIT * 4KB (512KB) per task to store the config received from host
+#define SEARCH_PAGE_DATA_BUFFER_ADDR   0xFC00000  // 252MB, NDP_SLOT_NUM pages per die to store the page data read from flash
 
 #define BUFFER_ADDR 		0x10000000  // 256MB
 #define SPARE_ADDR			(BUFFER_ADDR + BUF_ENTRY_NUM * BUF_ENTRY_SIZE)  // 256+16=272MB
@@ -101,6 +105,18 @@
 #define RETRY_LIMIT_TABLE_ADDR	(NEW_BAD_BLOCK_TABLE_ADDR + sizeof(struct newBadBlockArray))
 #define WAY_PRIORITY_TABLE_ADDR (RETRY_LIMIT_TABLE_ADDR + sizeof(struct retryLimitArray))
 
+// for NDP tasks, SEARCH_TASK_NUM of each
+#define SEARCH_TASK_ADDR	(WAY_PRIORITY_TABLE_ADDR + sizeof(struct wayPriorityArray))
+#define AC_AUTOMATON_ADDR	(SEARCH_TASK_ADDR + sizeof(struct searchTask) * SEARCH_TASK_NUM)
+#define BOUNDARY_RING_ADDR	(AC_AUTOMATON_ADDR + sizeof(struct acAutomaton) * SEARCH_TASK_NUM)
+#define REGEX_DFA_ADDR	(BOUNDARY_RING_ADDR + sizeof(struct pageBoundary) * BOUNDARY_RING_SIZE * SEARCH_TASK_NUM)
+#define LINE_BOUNDARY_ADDR	(REGEX_DFA_ADDR + sizeof(struct regexDfa) * SEARCH_TASK_NUM)
+#define NDP_STATE_ADDR	(LINE_BOUNDARY_ADDR + sizeof(struct lineBoundary) * BOUNDARY_RING_SIZE * SEARCH_TASK_NUM)  // NDP_MAX_STAGE * NDP_STATE_SIZE per task
+#define SEARCH_PAGE_MAP_ADDR	(NDP_STATE_ADDR + NDP_MAX_STAGE * NDP_STATE_SIZE * SEARCH_TASK_NUM)
+#define SEARCH_QUERY_ADDR	(SEARCH_PAGE_MAP_ADDR + sizeof(struct searchPageMap) * SEARCH_TASK_NUM)  // SEARCH_QUERY_NUM of them
+#define SEARCH_CACHE_ADDR	(SEARCH_QUERY_ADDR + sizeof(struct searchQuery) * SEARCH_QUERY_NUM)  // SEARCH_CACHE_NUM entries
+#define SEARCH_TAIL_ADDR	(SEARCH_CACHE_ADDR + sizeof(struct searchCacheEntry) * SEARCH_CACHE_NUM)  // SEARCH_TAIL_NUM of them
+
 /*
 // for 0-3 flash channel (HP port 0)
 #define COMPLETE_TABLE_ADDR0		0x80000000
@@ -0,0 +1,388 @@
+/**
+ * @file ndp.c
+ * @author Lin Li
+ * @brief the operator registry and the pipeline of the NDP tasks
+ *
+ * @copyright Copyright (c) 2023 Chongqing University StarLab
+ *
+ */
+#include "xil_printf.h"
+#include "xtime_l.h"
+#include "ndp.h"
+#include "search.h"
+#include "low_level_scheduler.h"
+#include "memory_map.h"
+
+static const struct ndpOperator *ndpRegistry[NDP_MAX_OPERATOR];
+
+// the pages read for the task and not computed yet, in the order they were read
+static struct ndpReadyPage readyPage[NDP_READY_PAGE_NUM];  // indexed by the slot, dieNo * NDP_SLOT_NUM + slot
+static unsigned char slotBusy[NDP_READY_PAGE_NUM];  // the slot is taken by a queued search read or holds a page not computed yet
+static unsigned short readyList[NDP_READY_PAGE_NUM];
+static unsigned int readyHead, readyCount;
+static unsigned char nextSlot[DIE_NUM];  // the slot the next search read of the die goes to
+
+static struct ndpRider riderPool[NDP_RIDER_NUM];
+static unsigned short riderFree;  // index+1 of the first free rider, they are chained by next
+
+// register the built-in operators, a new kernel adds its own here
+void ndpInit(){
+    readyHead = 0;
+    readyCount = 0;
+    for (unsigned int i = 0; i < NDP_READY_PAGE_NUM; i++)
+        slotBusy[i] = 0;
+    for (unsigned int i = 0; i < DIE_NUM; i++)
+        nextSlot[i] = 0;
+    for (unsigned int i = 0; i < NDP_RIDER_NUM; i++)
+        riderPool[i].next = i + 1 < NDP_RIDER_NUM ? i + 2 : 0;
+    riderFree = 1;
+
+    ndpRegister(SEARCH_OP_LITERAL, &searchOperator);
+    ndpRegister(SEARCH_OP_REGEX, &searchOperator);
+    ndpRegister(SEARCH_OP_APPROX, &searchOperator);
+    ndpRegister(SEARCH_OP_BINARY, &searchOperator);
+}
+
+/**
+ * @brief bind an operator to an opcode of the task config.
+ *
+ * @return 0 on success, 1 if the opcode is out of range or already taken.
+ */
+int ndpRegister(unsigned int opcode, const struct ndpOperator *op){
+    if (opcode >= NDP_MAX_OPERATOR || ndpRegistry[opcode]){
+        xil_printf("[ndpRegister] can not register %s as operator %d.\r\n", op->name, opcode);
+        return 1;
+    }
+
+    ndpRegistry[opcode] = op;
+    return 0;
+}
+
+// build the pipeline of the task from its stage sections, each stage parses its own section
+static unsigned int compileStages(char *config){
+    struct ndpPipeline *pipeline = &searchTask->pipeline;
+    unsigned int size = 0, header;
+
+    pipeline->stageNum = 0;
+    do{
+        struct ndpStage *stage = &pipeline->stage[pipeline->stageNum];
+        unsigned int stageSize;
+
+        header = *((unsigned int *)(config + size));
+        if (pipeline->stageNum >= NDP_MAX_STAGE){
+            xil_printf("[ndpCompile] more than %d stages.\r\n", NDP_MAX_STAGE);
+            return 0;
+        }
+
+        stage->opcode = (header >> 16) & 0xff;
+        if (stage->opcode >= NDP_MAX_OPERATOR || ndpRegistry[stage->opcode] == 0){
+            xil_printf("[ndpCompile] unknown operator: %d\r\n", stage->opcode);
+            return 0;
+        }
+        stage->op = ndpRegistry[stage->opcode];
+        if (stage->op->terminal && ((header >> 24) & NDP_FLAG_CHAIN)){
+            xil_printf("[ndpCompile] no stage can follow %s.\r\n", stage->op->name);
+            return 0;
+        }
+        stage->state = (void *)(NDP_STATE_ADDR + (searchTask->taskId * NDP_MAX_STAGE + pipeline->stageNum) * NDP_STATE_SIZE);
+        stage->next = 0;
+        if (pipeline->stageNum > 0)
+            pipeline->stage[pipeline->stageNum - 1].next = stage;
+        pipeline->stageNum++;
+
+        stageSize = stage->op->init(stage, config + size);
+        if (stageSize == 0)
+            return 0;
+        size += stageSize;
+    } while ((header >> 24) & NDP_FLAG_CHAIN);
+
+    return size;
+}
+
+/**
+ * @brief build the pipeline of the task from its stage sections, or from the
+ * ones of a prepared query whose tables are already built.
+ *
+ * @return the size of the stage sections in the config, 0 if one of them is
+ * invalid or there is no such query.
+ */
+unsigned int ndpCompile(char *config){
+    unsigned int header = *((unsigned int *)config);
+    char *prepared;
+
+    if (((header >> 16) & 0xff) != NDP_OP_QUERY)
+        return compileStages(config);
+
+    prepared = bindQuery(header & 0xffff);
+    return prepared && compileStages(prepared) ? 4 : 0;
+}
+
+// a page read for the task is ready in the data buffer, only [searchStart, searchEnd) belongs to the task
+void ndpInPage(unsigned int pageDataBufAddr, unsigned int pageIndex, unsigned int searchStart, unsigned int searchEnd, unsigned long long offset){
+    struct ndpStage *first = &searchTask->pipeline.stage[0];
+
+    if (!markPageDone(pageIndex))  // already accounted
+        return;
+    if (!searchTask->stopped)
+        first->op->page(first, pageIndex, (const unsigned char *)pageDataBufAddr + searchStart, searchEnd - searchStart, offset);
+}
+
+// a page of the task without data (e.g. an unreadable page)
+void ndpSkipPage(unsigned int pageIndex){
+    struct ndpStage *first = &searchTask->pipeline.stage[0];
+
+    if (!markPageDone(pageIndex))
+        return;
+    if (first->op->skip)
+        first->op->skip(first, pageIndex);
+    else
+        ndpEmitSkip(first, pageIndex);
+}
+
+void ndpFinish(){
+    for (unsigned int i = 0; i < searchTask->pipeline.stageNum; i++){
+        struct ndpStage *stage = &searchTask->pipeline.stage[i];
+        if (stage->op->finish)
+            stage->op->finish(stage);
+    }
+}
+
+// pass the output of a stage on to the next one, dropped after the last stage
+void ndpEmit(struct ndpStage *stage, unsigned int pageIndex, const unsigned char *data, unsigned int len, unsigned long long offset){
+    struct ndpStage *next = stage->next;
+
+    if (next)
+        next->op->page(next, pageIndex, data, len, offset);
+}
+
+void ndpEmitSkip(struct ndpStage *stage, unsigned int pageIndex){
+    struct ndpStage *next = stage->next;
+
+    if (next == 0)
+        return;
+    if (next->op->skip)
+        next->op->skip(next, pageIndex);
+    else
+        ndpEmitSkip(next, pageIndex);
+}
+
+// a search read can be pushed to the die, one of its staging slots is free
+int ndpSlotFree(unsigned int dieNo){
+    for (unsigned int slot = 0; slot < NDP_SLOT_NUM; slot++)
+        if (!slotBusy[dieNo * NDP_SLOT_NUM + slot])
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief take a free staging slot of the die for a search read, it is held
+ * until the page is computed, so the transfer never waits for the compute.
+ * The free slots are used in turn, so the read of a page overlaps the compute
+ * of the pages before.
+ *
+ * @return the slot, NDP_SLOT_NUM if all of them are taken (the callers check
+ * ndpSlotFree() before pushing the read).
+ */
+unsigned int ndpAllocSlot(int chNo, int wayNo){
+    unsigned int dieNo = wayNo * CHANNEL_NUM + chNo;
+
+    for (unsigned int i = 0; i < NDP_SLOT_NUM; i++){
+        unsigned int slot = (nextSlot[dieNo] + i) % NDP_SLOT_NUM;
+
+        if (!slotBusy[dieNo * NDP_SLOT_NUM + slot]){
+            slotBusy[dieNo * NDP_SLOT_NUM + slot] = 1;
+            nextSlot[dieNo] = (slot + 1) % NDP_SLOT_NUM;
+            return slot;
+        }
+    }
+
+    xil_printf("[ndpAllocSlot] no free staging slot on ch %d way %d!\r\n", chNo, wayNo);
+    return NDP_SLOT_NUM;
+}
+
+// the search read holding the slot is dropped or failed, no page comes to the slot
+void ndpReleaseSlot(int chNo, int wayNo, unsigned int slot){
+    slotBusy[(wayNo * CHANNEL_NUM + chNo) * NDP_SLOT_NUM + slot] = 0;
+}
+
+/**
+ * @brief the transfer of a page read for the task is done, leave the compute
+ * to ndpDrain() so that the scheduler keeps serving the other dies.
+ */
+void ndpQueuePage(int chNo, int wayNo, unsigned int slot, unsigned int taskId, unsigned int pageDataBufAddr, unsigned int pageIndex, unsigned int searchStart, unsigned int searchEnd, unsigned long long offset,
+        unsigned int lpn, unsigned short riders){
+    unsigned int slotNo = (wayNo * CHANNEL_NUM + chNo) * NDP_SLOT_NUM + slot;
+    struct ndpReadyPage *page = &readyPage[slotNo];
+
+    page->taskId = taskId;
+    page->pageDataBuf = pageDataBufAddr;
+    page->pageIndex = pageIndex;
+    page->searchStart = searchStart;
+    page->searchEnd = searchEnd;
+    page->offset = offset;
+    page->lpn = lpn;
+    page->riders = riders;
+    readyList[(readyHead + readyCount) % NDP_READY_PAGE_NUM] = slotNo;
+    readyCount++;
+}
+
+// put a list of riders back to the free ones
+static void releaseRiders(unsigned short riders){
+    unsigned short last = riders;
+
+    if (riders == 0)
+        return;
+    while (riderPool[last - 1].next)
+        last = riderPool[last - 1].next;
+    riderPool[last - 1].next = riderFree;
+    riderFree = riders;
+}
+
+static void ndpDrainOne(){
+    unsigned int slotNo = readyList[readyHead];
+    struct ndpReadyPage *page = &readyPage[slotNo];
+    unsigned int prev;
+
+    readyHead = (readyHead + 1) % NDP_READY_PAGE_NUM;
+    readyCount--;
+    prev = selectSearchTask(page->taskId);  // may run while another task is queueing its pages
+    ndpInPage(page->pageDataBuf, page->pageIndex, page->searchStart, page->searchEnd, page->offset);
+    for (unsigned short r = page->riders; r; r = riderPool[r - 1].next){  // the operators only read the slot
+        struct ndpRider *rider = &riderPool[r - 1];
+
+        selectSearchTask(rider->taskId);
+        ndpInPage(page->pageDataBuf, rider->pageIndex, rider->searchStart, rider->searchEnd, rider->offset);
+    }
+    releaseRiders(page->riders);
+    page->riders = 0;
+    selectSearchTask(prev);
+    slotBusy[slotNo] = 0;
+}
+
+// the task stopped, free the slots of its pages waiting for the compute, return how many were dropped.
+// A page another task rides on is kept for that task.
+unsigned int ndpCancel(unsigned int taskId){
+    unsigned int kept = 0, dropped = 0;
+
+    for (unsigned int i = 0; i < readyCount; i++){
+        unsigned int slotNo = readyList[(readyHead + i) % NDP_READY_PAGE_NUM];
+        struct ndpReadyPage *page = &readyPage[slotNo];
+        struct ndpRider owner;
+
+        dropped += ndpDropRiders(&page->riders, taskId);
+        if (page->taskId == taskId){
+            dropped++;
+            if (!ndpPromoteRider(&page->riders, &owner)){
+                slotBusy[slotNo] = 0;
+                continue;
+            }
+            page->taskId = owner.taskId;
+            page->pageIndex = owner.pageIndex;
+            page->searchStart = owner.searchStart;
+            page->searchEnd = owner.searchEnd;
+            page->offset = owner.offset;
+        }
+        readyList[(readyHead + kept++) % NDP_READY_PAGE_NUM] = slotNo;
+    }
+    readyCount = kept;
+    return dropped;
+}
+
+/**
+ * @brief a page of the selected task needs an lpn whose search read is
+ * already queued, or transferred and waiting for the compute, so it rides on
+ * that read instead of reading the flash again. Each rider is computed by its
+ * own task from the same staging slot, so the reads of the tasks scanning a
+ * file at the same time follow the pages, not the tasks.
+ *
+ * @return 1 if the page rides on another read, 0 if it has to be read.
+ */
+int ndpShareRead(unsigned int lpn, unsigned int pageIndex, unsigned int searchStart, unsigned int searchEnd, unsigned long long offset){
+    unsigned short *riders = 0;
+    struct reqEntry *entry;
+    struct ndpRider *rider;
+    unsigned short r = riderFree;
+
+    if (r == 0)
+        return 0;
+    for (unsigned int i = 0; i < readyCount && riders == 0; i++){
+        struct ndpReadyPage *page = &readyPage[readyList[(readyHead + i) % NDP_READY_PAGE_NUM]];
+
+        if (page->lpn == lpn)
+            riders = &page->riders;
+    }
+    if (riders == 0 && (entry = FindSearchReq(lpn)) != 0)
+        riders = &entry->searchRiders;
+    if (riders == 0)
+        return 0;
+
+    rider = &riderPool[r - 1];
+    riderFree = rider->next;
+    rider->taskId = searchTask->taskId;
+    rider->pageIndex = pageIndex;
+    rider->searchStart = searchStart;
+    rider->searchEnd = searchEnd;
+    rider->offset = offset;
+    rider->next = *riders;
+    *riders = r;
+    qosCounter.searchShared++;
+    return 1;
+}
+
+// drop the riders of the task from the list of a read, return how many were dropped
+unsigned int ndpDropRiders(unsigned short *riders, unsigned int taskId){
+    unsigned int dropped = 0;
+
+    while (*riders){
+        unsigned short r = *riders;
+        struct ndpRider *rider = &riderPool[r - 1];
+
+        if (rider->taskId == taskId){
+            *riders = rider->next;
+            rider->next = riderFree;
+            riderFree = r;
+            dropped++;
+        }
+        else
+            riders = &rider->next;
+    }
+    return dropped;
+}
+
+// the owner of a read is dropped, its first rider takes its place, return 0 if there is none
+int ndpPromoteRider(unsigned short *riders, struct ndpRider *owner){
+    unsigned short r = *riders;
+
+    if (r == 0)
+        return 0;
+    *owner = riderPool[r - 1];
+    *riders = owner->next;
+    riderPool[r - 1].next = riderFree;
+    riderFree = r;
+    return 1;
+}
+
+// the read the riders share failed, each of their tasks reads its page again later or gives it up
+void ndpFailRiders(unsigned short riders, unsigned int lpn){
+    for (unsigned short r = riders; r; r = riderPool[r - 1].next){
+        struct ndpRider *rider = &riderPool[r - 1];
+
+        failSearchPage(rider->taskId, lpn, rider->pageIndex, rider->searchStart, rider->searchEnd, rider->offset);
+    }
+    releaseRiders(riders);
+}
+
+// compute the ready pages for about budgetUs, called between the passes of the scheduler
+void ndpDrain(unsigned int budgetUs){
+    XTime tEnd, tCur;
+
+    if (readyCount == 0)
+        return;
+
+    XTime_GetTime(&tCur);
+    tEnd = tCur + (((XTime) budgetUs) * (COUNTS_PER_SECOND / 1000000));
+    do{
+        ndpDrainOne();
+        XTime_GetTime(&tCur);
+    } while (readyCount && tCur < tEnd);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file ndp.h
+ * @author Lin Li
+ * @brief the operator registry of the NDP tasks. A task is a pipeline of
+ * stages, each stage is an operator picked by the opcode in its section of
+ * the task config. The scheduler only hands the pages to the pipeline, so a
+ * new in-storage kernel is an operator registered in ndpInit().
+ *
+ * @copyright Copyright (c) 2023 Chongqing University StarLab
+ *
+ */
+#ifndef NDP_H_
+#define NDP_H_
+
+#include "init_ftl.h"
+
+#define NDP_MAX_STAGE 4  // stages chained in one task
+#define NDP_MAX_OPERATOR 16  // opcodes of the registry
+#define NDP_STATE_SIZE (64 * 1024)  // bytes of per-task state of each stage, NDP_MAX_STAGE of them per task at NDP_STATE_ADDR
+
+#define NDP_SLOT_NUM 4  // search staging slots of each die, at SEARCH_PAGE_DATA_BUFFER_ADDR
+#define NDP_READY_PAGE_NUM (DIE_NUM * NDP_SLOT_NUM)
+#define NDP_RIDER_NUM (3 * NDP_READY_PAGE_NUM)  // pages riding on the search read of another page, SEARCH_TASK_NUM tasks with all their pages in flight
+#define NDP_DRAIN_BUDGET_US 100  // compute time given to the ready pages in each pass of nvme_main(), at least one page is done
+
+// a stage section starts with a header word: bits 0-15 are the operator's, bits 16-23 the opcode, bits 24-31 the flags
+#define NDP_FLAG_CHAIN 0x80  // in the flags, another stage section follows this one
+#define NDP_OP_QUERY 0xff  // in the opcode of the first section, the only one: the stages are the ones of the prepared query whose handle is in bits 0-15
+
+struct ndpStage;
+
+struct ndpOperator
+{
+    const char *name;
+    // parse the section of the stage (header word included), return its size, 0 if it is invalid
+    unsigned int (*init)(struct ndpStage *stage, char *config);
+    // the bytes of a page of the task or the output of the stage before, ndpEmit() passes data on
+    void (*page)(struct ndpStage *stage, unsigned int pageIndex, const unsigned char *data, unsigned int len, unsigned long long offset);
+    // a page without data, NULL to pass it on
+    void (*skip)(struct ndpStage *stage, unsigned int pageIndex);
+    // all the pages are done, called in the stage order before the completion, can be NULL
+    void (*finish)(struct ndpStage *stage);
+    unsigned int terminal;  // never calls ndpEmit(), so no stage can be chained after it
+};
+
+struct ndpStage
+{
+    unsigned int opcode;
+    const struct ndpOperator *op;
+    void *state;  // NDP_STATE_SIZE bytes kept for the stage during the task
+    struct ndpStage *next;  // 0 for the last stage
+};
+
+struct ndpPipeline
+{
+    unsigned int stageNum;
+    struct ndpStage stage[NDP_MAX_STAGE];
+};
+
+// a page read for the task that waits in its staging slot for the compute
+struct ndpReadyPage
+{
+    unsigned int taskId;
+    unsigned int pageDataBuf;
+    unsigned int pageIndex;
+    unsigned int searchStart;
+    unsigned int searchEnd;
+    unsigned long long offset;
+    unsigned int lpn;
+    unsigned short riders;  // index+1 of the first ndpRider, the pages of the other tasks computed from the same slot
+};
+
+// a page of a task whose lpn is already read for another page, queued or staged, so it shares that read
+struct ndpRider
+{
+    unsigned int taskId;
+    unsigned int pageIndex;
+    unsigned int searchStart;
+    unsigned int searchEnd;
+    unsigned long long offset;
+    unsigned short next;  // index+1 of the next rider of the read, 0 after the last one
+};
+
+void ndpInit();
+int ndpRegister(unsigned int opcode, const struct ndpOperator *op);
+
+unsigned int ndpCompile(char *config);
+void ndpInPage(unsigned int pageDataBufAddr, unsigned int pageIndex, unsigned int searchStart, unsigned int searchEnd, unsigned long long offset);
+void ndpSkipPage(unsigned int pageIndex);
+void ndpFinish();
+
+int ndpSlotFree(unsigned int dieNo);
+unsigned int ndpAllocSlot(int chNo, int wayNo);
+void ndpReleaseSlot(int chNo, int wayNo, unsigned int slot);
+void ndpQueuePage(int chNo, int wayNo, unsigned int slot, unsigned int taskId, unsigned int pageDataBufAddr, unsigned int pageIndex, unsigned int searchStart, unsigned int searchEnd, unsigned long long offset,
+        unsigned int lpn, unsigned short riders);
+void ndpDrain(unsigned int budgetUs);
+unsigned int ndpCancel(unsigned int taskId);
+
+int ndpShareRead(unsigned int lpn, unsigned int pageIndex, unsigned int searchStart, unsigned int searchEnd, unsigned long long offset);
+unsigned int ndpDropRiders(unsigned short *riders, unsigned int taskId);
+int ndpPromoteRider(unsigned short *riders, struct ndpRider *owner);
+void ndpFailRiders(unsigned short riders, unsigned int lpn);
+
+void ndpEmit(struct ndpStage *stage, unsigned int pageIndex, const unsigned char *data, unsigned int len, unsigned long long offset);
+void ndpEmitSkip(struct ndpStage *stage, unsigned int pageIndex);
+
+#endif
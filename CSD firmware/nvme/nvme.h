@@ -82,6 +82,7 @@
 #define IO_NVM_WRITE_UNCORRECTABLE							0x04
 #define IO_NVM_COMPARE										0x05
 #define IO_NVM_DATASET_MANAGEMENT							0x09
+#define IO_NVM_SEARCH										0x83	// vendor specific, an NDP task, bidirectional: the config goes to the device and the results come back
 
 
 /*Status Code Type */
@@ -63,6 +63,11 @@
 #include "../search.h"
 #include "../io_cmd.h"
 
+static unsigned int aerSlotTag[ASYNC_EVENT_REQUEST_NUM];  // the requests held until an event is posted
+static unsigned int aerNum;
+static unsigned int asyncEvent[ASYNC_EVENT_QUEUE_DEPTH];  // dword0 of the events posted while no request was held
+static unsigned int asyncEventHead, asyncEventNum;
+
 extern NVME_CONTEXT g_nvmeTask;
 
 unsigned int get_num_of_queue(unsigned int dword11)
@@ -152,6 +157,85 @@ void handle_set_features(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvme
 	xil_printf("Set Feature FID:%X\r\n", features.FID);
 }
 
+// take a search task from the host, by Get Features or IO_NVM_SEARCH, kind is the FID (dword10 of IO_NVM_SEARCH):
+// 0x11/0x12 complete when the task is done, a background job (0x16/0x17) or an asynchronous task (0x1A/0x1B)
+// completes with the task id once the config is in. 0x12, 0x17 and 0x1B walk the path, the others take the extents.
+// 0x1C prepares the stage sections of its config as a query and completes with its handle
+// return 1 if the command is completed later, 0 if nvmeCPL is its completion
+int handle_search_task(unsigned int kind, unsigned int dword11, unsigned int dword12, unsigned int dword13,
+		unsigned int dword14, unsigned int dword15, unsigned int cmdSlotTag, NVME_COMPLETION *nvmeCPL)
+{
+	NVME_COMPLETION cpl;
+	unsigned int detached = kind == 0x16 || kind == 0x17 || kind == 0x1A || kind == 0x1B;
+	unsigned int prepare = kind == 0x1C;
+	unsigned int configUnit = dword13 ? dword13 : 1;  // older hosts send one 4KB unit
+	unsigned int resultMax;
+
+	cpl.dword[0] = 0x0;
+	nvmeCPL->specific = 0x0;
+	if (kind != 0x11 && kind != 0x12 && !detached && !prepare){
+		xil_printf("unknown kind of search task: %X\r\n", kind);
+		cpl.statusField.SC = INVALID_FIELD_IN_COMMAND;
+		nvmeCPL->dword[0] = cpl.dword[0];
+		return 0;
+	}
+	if (configUnit > SEARCH_CONFIG_MAX_UNIT){
+		xil_printf("the task config of %d units is too large, at most %d.\r\n", configUnit, SEARCH_CONFIG_MAX_UNIT);
+		cpl.statusField.SC = INVALID_FIELD_IN_COMMAND;
+		nvmeCPL->dword[0] = cpl.dword[0];
+		return 0;
+	}
+	if (allocSearchTask() == 0){
+		xil_printf("all the %d search tasks are running, try again later.\r\n", SEARCH_TASK_NUM);
+		cpl.statusField.SC = SEARCH_SC_BUSY;  // a resource limit, not a fault of the device
+		cpl.statusField.DNR = 0;
+		nvmeCPL->dword[0] = cpl.dword[0];
+		return 0;
+	}
+	if (kind == 0x12)
+		XTime_GetTime(&time_start_search);
+
+	for (unsigned int i = 0; i < configUnit; i++)
+		set_auto_rx_dma(cmdSlotTag, i, DMA_TASK_CONFIG_ADDR + (searchTask->taskId * SEARCH_CONFIG_MAX_UNIT + i) * 4096);
+	searchTask->taskValid = 1;
+	searchTask->cmdSlotTag = cmdSlotTag;
+	searchTask->pageCompleteCount = 0;
+	searchTask->totalHitCounts = 0;
+	searchTask->searchPageNum = 0;
+	searchTask->resultNum = 0;
+	searchTask->retryNum = 0;
+	searchTask->unreadableNum = 0;
+	searchTask->unreadablePages = 0;
+	searchTask->trailerResults = 0;
+	searchTask->stopAfter = dword14;
+	searchTask->stopped = 0;
+	searchTask->tag = dword12;
+	searchTask->deadline = 0;
+	searchTask->background = detached;
+	searchTask->jobState = 0;
+	searchTask->failStatus = 0;
+	searchTask->prepare = prepare;
+	searchTask->query = 0;
+	searchTask->cacheIno = 0;
+	searchTask->cacheHit = 0;
+	searchTask->incremental = 0;
+	if (kind == 0x16 || kind == 0x17)
+		searchTask->idleMs = dword15 ? dword15 : SEARCH_JOB_IDLE_MS;
+	else
+		searchTask->idleMs = 0;
+	searchTask->configUnit = configUnit;
+	// the results of a detached task go to the command that reads them, all its 4KB units are free
+	resultMax = detached ? SEARCH_RESULT_MAX_NUM(0) : SEARCH_RESULT_MAX_NUM(configUnit);
+	searchTask->resultCap = dword11 < resultMax ? dword11 : resultMax;
+	searchTask->rxDmaExe = 1;
+	searchTask->rxDmaTail = g_hostDmaStatus.fifoTail.autoDmaRx;
+	searchTask->rxDmaOverFlowCnt = g_hostDmaAssistStatus.autoDmaRxOverFlowCnt;
+	searchTask->need_path_walk = kind == 0x12 || kind == 0x17 || kind == 0x1B;
+	reservedReq = 1;
+
+	return 1;
+}
+
 int handle_get_features(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL, unsigned int cmdSlotTag)
 {
 	ADMIN_GET_FEATURES_DW10 features;
@@ -192,40 +276,55 @@ int handle_get_features(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeC
 			break;
 		}
 		case 0x11:  // not need retrieve
+		case 0x12:  // need retrieve
+		case 0x16:  // background job, not need retrieve
+		case 0x17:  // background job, need retrieve
+		case 0x1A:  // asynchronous task, not need retrieve
+		case 0x1B:  // asynchronous task, need retrieve
+		case 0x1C:  // prepare a query
 		{
-			set_auto_rx_dma(cmdSlotTag, 0, DMA_TASK_CONFIG_ADDR);
-			searchTask->taskValid = 1;
-			searchTask->cmdSlotTag = cmdSlotTag;
-			searchTask->pageCompleteCount = 0;
-			searchTask->totalHitCounts = 0;
-			searchTask->searchPageNum = 0;
-			searchTask->rxDmaExe = 1;
-			searchTask->rxDmaTail = g_hostDmaStatus.fifoTail.autoDmaRx;
-			searchTask->rxDmaOverFlowCnt = g_hostDmaAssistStatus.autoDmaRxOverFlowCnt;
-			searchTask->need_path_walk = 0;
-			reservedReq = 1;  
-
-			// set_auto_nvme_cpl(cmdSlotTag, 0x0, 0x0);
-			// break;
-			return 1;
+			if (handle_search_task(features.FID, nvmeAdminCmd->dword11, nvmeAdminCmd->dword12, nvmeAdminCmd->dword13,
+					nvmeAdminCmd->dword14, nvmeAdminCmd->dword15, cmdSlotTag, nvmeCPL))
+				return 1;
+			break;
 		}
-		case 0x12:  // need retrieve
+		case 0x15:  // QoS counters, dword11 selects one, see struct qosCounter
 		{
-			XTime_GetTime(&time_start_search);
-			set_auto_rx_dma(cmdSlotTag, 0, DMA_TASK_CONFIG_ADDR);
-			searchTask->taskValid = 1;
-			searchTask->cmdSlotTag = cmdSlotTag;
-			searchTask->pageCompleteCount = 0;
-			searchTask->totalHitCounts = 0;
-			searchTask->searchPageNum = 0;
-			searchTask->rxDmaExe = 1;
-			searchTask->rxDmaTail = g_hostDmaStatus.fifoTail.autoDmaRx;
-			searchTask->rxDmaOverFlowCnt = g_hostDmaAssistStatus.autoDmaRxOverFlowCnt;
-			searchTask->need_path_walk = 1;
-			reservedReq = 1;
-
-			// set_auto_nvme_cpl(cmdSlotTag, 0x0, 0x0);
-			return 1;
+			unsigned int *counter = (unsigned int *)&qosCounter;
+
+			xil_printf("search reads deferred: %d, search pushes held: %d, host pushes on a full queue: %d\r\n",
+					qosCounter.searchDeferred, qosCounter.searchHeld, qosCounter.hostFull);
+			nvmeCPL->dword[0] = 0x0;
+			nvmeCPL->specific = nvmeAdminCmd->dword11 < sizeof(struct qosCounter) / 4 ? counter[nvmeAdminCmd->dword11] : 0x0;
+			break;
+		}
+		case 0x18:  // poll the background job in dword11
+		{
+			int done = pollSearchJob(nvmeAdminCmd->dword11, cmdSlotTag);
+
+			if (done == 1)
+				return 1;
+			cpl.dword[0] = 0x0;
+			if (done < 0){
+				xil_printf("no background job %d or it failed.\r\n", nvmeAdminCmd->dword11);
+				cpl.statusField.SC = INVALID_FIELD_IN_COMMAND;
+			}
+			nvmeCPL->dword[0] = cpl.dword[0];
+			nvmeCPL->specific = done < 0 ? 0x0 : SEARCH_RESULT_PENDING;
+			break;
+		}
+		case 0x19:  // cancel the tasks the host gave the tag in dword11
+		{
+			unsigned int num = nvmeAdminCmd->dword11 ? cancelSearchTasks(nvmeAdminCmd->dword11) : 0;
+
+			cpl.dword[0] = 0x0;
+			if (num == 0){
+				xil_printf("no search task with the tag %d.\r\n", nvmeAdminCmd->dword11);
+				cpl.statusField.SC = INVALID_FIELD_IN_COMMAND;
+			}
+			nvmeCPL->dword[0] = cpl.dword[0];
+			nvmeCPL->specific = num;
+			break;
 		}
 		case 0x14:  // flush half the pages
 		{
@@ -419,8 +518,19 @@ void handle_identify(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL)
 	nvmeCPL->specific = 0x0;
 }
 
-void handle_get_log_page(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL)
+int handle_get_log_page(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL, unsigned int cmdSlotTag)
 {
+	unsigned int lid = nvmeAdminCmd->dword10 & 0xFF;
+
+	if(lid >= SEARCH_LOG_PAGE && lid < SEARCH_LOG_PAGE + SEARCH_TASK_NUM)
+	{
+		// NUMDL in dword10, NUMDU in dword11, 0's based
+		unsigned int bytes = (((nvmeAdminCmd->dword10 >> 16) | ((nvmeAdminCmd->dword11 & 0xFFFF) << 16)) + 1) * 4;
+
+		readSearchLog(lid - SEARCH_LOG_PAGE, cmdSlotTag, bytes);
+		return 1;
+	}
+
 	//ADMIN_GET_LOG_PAGE_DW10 getLogPageInfo;
 
 	//unsigned int prp1[2];
@@ -448,6 +558,55 @@ void handle_get_log_page(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvme
 
 	nvmeCPL->dword[0] = 0;
 	nvmeCPL->specific = 0x9;//invalid log page
+	return 0;
+}
+
+// complete a held asynchronous event request, or keep the event until the host sends one
+void post_async_event(unsigned int type, unsigned int info, unsigned int logPage)
+{
+	unsigned int dword0 = (type & 0x7) | ((info & 0xFF) << 8) | ((logPage & 0xFF) << 16);
+
+	if(aerNum)
+	{
+		aerNum--;
+		set_auto_nvme_cpl(aerSlotTag[aerNum], dword0, 0x0);
+	}
+	else if(asyncEventNum < ASYNC_EVENT_QUEUE_DEPTH)
+	{
+		asyncEvent[(asyncEventHead + asyncEventNum) % ASYNC_EVENT_QUEUE_DEPTH] = dword0;
+		asyncEventNum++;
+	}
+	else
+		xil_printf("the asynchronous event 0x%X is dropped.\r\n", dword0);
+}
+
+static void hold_async_event_request(unsigned int cmdSlotTag)
+{
+	NVME_COMPLETION cpl;
+
+	if(asyncEventNum)
+	{
+		set_auto_nvme_cpl(cmdSlotTag, asyncEvent[asyncEventHead], 0x0);
+		asyncEventHead = (asyncEventHead + 1) % ASYNC_EVENT_QUEUE_DEPTH;
+		asyncEventNum--;
+	}
+	else if(aerNum < ASYNC_EVENT_REQUEST_NUM)
+		aerSlotTag[aerNum++] = cmdSlotTag;
+	else
+	{
+		cpl.dword[0] = 0x0;
+		cpl.statusField.SCT = 0x1;
+		cpl.statusField.SC = ASYNC_EVENT_LIMIT_EXCEEDED;
+		set_auto_nvme_cpl(cmdSlotTag, 0x0, cpl.statusFieldWord);
+	}
+}
+
+// the held requests are gone with the admin queue
+void reset_async_events()
+{
+	aerNum = 0;
+	asyncEventHead = 0;
+	asyncEventNum = 0;
 }
 
 void handle_nvme_admin_cmd(NVME_COMMAND *nvmeCmd, unsigned int* printIOinfo)
@@ -504,15 +663,13 @@ void handle_nvme_admin_cmd(NVME_COMMAND *nvmeCmd, unsigned int* printIOinfo)
 		}
 		case ADMIN_ASYNCHRONOUS_EVENT_REQUEST:
 		{
-			needCpl = 0;
-			needSlotRelease = 1;
-			nvmeCPL.dword[0] = 0;
-			nvmeCPL.specific = 0x0;
-			break;
+			hold_async_event_request(nvmeCmd->cmdSlotTag);  // completed by post_async_event()
+			return;
 		}
 		case ADMIN_GET_LOG_PAGE:
 		{
-			handle_get_log_page(nvmeAdminCmd, &nvmeCPL);
+			if (handle_get_log_page(nvmeAdminCmd, &nvmeCPL, nvmeCmd->cmdSlotTag))
+				return;
 			break;
 		}
 
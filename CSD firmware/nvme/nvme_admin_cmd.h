@@ -47,11 +47,18 @@
 #ifndef __NVME_ADMIN_CMD_H_
 #define __NVME_ADMIN_CMD_H_
 
+#define ASYNC_EVENT_REQUEST_NUM		4	// AERL + 1 in the identify data
+#define ASYNC_EVENT_QUEUE_DEPTH		8	// events kept while no request is outstanding
+#define ASYNC_EVENT_VENDOR			0x7	// the asynchronous event type of the vendor specific events
+#define ASYNC_EVENT_LIMIT_EXCEEDED	0x5	// command specific status of a request over the limit
 
 unsigned int get_num_of_queue(unsigned int dword11);
 
 void handle_set_features(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL, unsigned int* printIOinfo);
 
+int handle_search_task(unsigned int kind, unsigned int dword11, unsigned int dword12, unsigned int dword13,
+		unsigned int dword14, unsigned int dword15, unsigned int cmdSlotTag, NVME_COMPLETION *nvmeCPL);
+
 int handle_get_features(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL, unsigned int cmdSlotTag);
 
 void handle_create_io_cq(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL);
@@ -64,7 +71,11 @@ void handle_delete_io_sq(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvme
 
 void handle_identify(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL);
 
-void handle_get_log_page(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL);
+int handle_get_log_page(NVME_ADMIN_COMMAND *nvmeAdminCmd, NVME_COMPLETION *nvmeCPL, unsigned int cmdSlotTag);
+
+void post_async_event(unsigned int type, unsigned int info, unsigned int logPage);
+
+void reset_async_events();
 
 void handle_nvme_admin_cmd(NVME_COMMAND *nvmeCmd, unsigned int* printIOinfo);
 
@@ -57,7 +57,9 @@
 #include "nvme.h"
 #include "host_lld.h"
 #include "nvme_io_cmd.h"
+#include "nvme_admin_cmd.h"
 #include "../memory_map.h"
+#include "../search.h"
 
 #include "../lru_buffer.h"
 
@@ -143,6 +145,7 @@ void handle_nvme_io_cmd(NVME_COMMAND *nvmeCmd, unsigned int* printIOinfo)
 	{
 		case IO_NVM_FLUSH:
 		{
+			markHostBusy();
 			xil_printf("IO Flush Command\r\n");
 			nvmeCPL.dword[0] = 0;
 			nvmeCPL.specific = 0x0;
@@ -152,15 +155,25 @@ void handle_nvme_io_cmd(NVME_COMMAND *nvmeCmd, unsigned int* printIOinfo)
 		case IO_NVM_WRITE:
 		{
 			//xil_printf("IO Write Command\r\n");
+			markHostBusy();
 			handle_nvme_io_write(nvmeCmd->cmdSlotTag, nvmeIOCmd, printIOinfo);
 			break;
 		}
 		case IO_NVM_READ:
 		{
 			//xil_printf("IO Read Command\r\n");
+			markHostBusy();
 			handle_nvme_io_read(nvmeCmd->cmdSlotTag, nvmeIOCmd, printIOinfo);
 			break;
 		}
+		case IO_NVM_SEARCH:
+		{
+			// dword10 is the kind of the task as the FID of the search Get Features, the other dwords are the same
+			if(handle_search_task(nvmeIOCmd->dword10, nvmeIOCmd->dword11, nvmeIOCmd->dword12, nvmeIOCmd->dword13,
+					nvmeIOCmd->dword14, nvmeIOCmd->dword15, nvmeCmd->cmdSlotTag, &nvmeCPL) == 0)
+				set_auto_nvme_cpl(nvmeCmd->cmdSlotTag, nvmeCPL.specific, nvmeCPL.statusFieldWord);
+			break;
+		}
 		default:
 		{
 			xil_printf("Not Support IO Command OPC: %X\r\n", opc);
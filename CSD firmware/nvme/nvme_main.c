@@ -92,6 +92,7 @@ void nvme_main()
 	xil_printf("!!! Wait until FTL reset complete !!! \r\n");
 
 	initSearchTask();
+	ndpInit();
 	init_metadata();
 
 	LRUBufInit();
@@ -160,6 +161,7 @@ void nvme_main()
 				}
 
 				set_nvme_admin_queue(0, 0, 0);
+				reset_async_events();
 				g_nvmeTask.cacheEn = 0;
 				set_nvme_csts_shst(2);
 				g_nvmeTask.status = NVME_TASK_WAIT_RESET;
@@ -189,6 +191,7 @@ void nvme_main()
 			}
 			g_nvmeTask.cacheEn = 0;
 			set_nvme_admin_queue(0, 0, 0);
+			reset_async_events();
 			set_nvme_csts_shst(0);
 			set_nvme_csts_rdy(0);
 			g_nvmeTask.status = NVME_TASK_IDLE;
@@ -198,8 +201,10 @@ void nvme_main()
 		if(exeLlr && reservedReq)
 			ExeLowLevelReq(SUB_REQ_QUEUE);
 
-		if(searchTask->taskValid)
-			CheckTaskDone();
+		ndpDrain(NDP_DRAIN_BUDGET_US);
+
+		FeedSearchTasks();
+		CheckTaskDone();
 	}
 }
 
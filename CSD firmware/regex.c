@@ -0,0 +1,694 @@
+/**
+ * @file regex.c
+ * @author Lin Li
+ * @brief the regular expression operator of the in-storage search. The
+ * pattern is parsed into a syntax tree, turned into a Thompson NFA and then
+ * into a search DFA by subset construction, so that matching costs one table
+ * lookup per byte. Nothing in this file touches the hardware.
+ *
+ * Supported syntax: literals, '.', [classes] with ranges and '^' negation,
+ * \d \D \w \W \s \S \t \xHH and escaped metacharacters, '^' and '$' line
+ * anchors, '|', '(' ')', and the '*' '+' '?' {m} {m,} {m,n} repetitions.
+ *
+ * Lines are matched independently, the scan restarts after every match, so
+ * the matches counted are the shortest non-overlapping ones.
+ *
+ * @copyright Copyright (c) 2023 Chongqing University StarLab
+ *
+ */
+#include <string.h>
+#include "regex.h"
+
+#define RE_MAX_NODE (2 * REGEX_MAX_LEN)
+#define RE_MAX_SET REGEX_MAX_LEN
+#define RE_MAX_REPEAT 255
+#define RE_REPEAT_INF 0xffff
+#define RE_NONE 0xffff
+#define RE_SET_WORDS (REGEX_MAX_NFA_STATE / 32)
+#define RE_HASH_SIZE (2 * REGEX_MAX_STATE)
+
+enum { RE_CHAR, RE_CAT, RE_ALT, RE_STAR, RE_PLUS, RE_QUEST, RE_REPEAT, RE_BOL, RE_EOL, RE_EMPTY };
+enum { NFA_CHAR, NFA_SPLIT, NFA_BOL, NFA_EOL, NFA_MATCH };
+
+struct reNode
+{
+    unsigned char type;
+    unsigned short left;  // the byte set of RE_CHAR
+    unsigned short right;
+    unsigned short min, max;  // RE_REPEAT
+};
+
+struct nfaState
+{
+    unsigned char type;
+    unsigned short set;  // NFA_CHAR
+    unsigned short out, out1;
+};
+
+const char *regexError;
+
+// syntax tree
+static const char *reCursor;
+static struct reNode reNode[RE_MAX_NODE];
+static unsigned int reNodeNum;
+static unsigned int reSet[RE_MAX_SET][8];  // byte sets, one bit per byte
+static unsigned int reSetNum;
+static unsigned int reFold;  // the byte sets hold both cases of their ASCII letters
+
+// NFA
+static struct nfaState nfa[REGEX_MAX_NFA_STATE];
+static unsigned int nfaNum;
+
+// subset construction
+static unsigned int dfaSet[REGEX_MAX_STATE][RE_SET_WORDS];
+static unsigned short dfaHash[RE_HASH_SIZE];
+static unsigned short nfaStack[REGEX_MAX_NFA_STATE];
+static unsigned char byteClass[256];
+static unsigned char classRep[256];
+
+// regex_map
+static unsigned short groupState[REGEX_MAX_STATE], groupOf[REGEX_MAX_STATE], stateGroup[REGEX_MAX_STATE], liveGroup[REGEX_MAX_STATE];
+static unsigned int groupCount[REGEX_MAX_STATE];
+static int originBase[REGEX_MAX_STATE];
+
+static unsigned int newNode(unsigned int type, unsigned int left, unsigned int right){
+    if (reNodeNum >= RE_MAX_NODE){
+        regexError = "pattern too long";
+        return RE_NONE;
+    }
+    reNode[reNodeNum].type = type;
+    reNode[reNodeNum].left = left;
+    reNode[reNodeNum].right = right;
+    reNode[reNodeNum].min = reNode[reNodeNum].max = 0;
+    return reNodeNum++;
+}
+
+static unsigned int newSet(){
+    if (reSetNum >= RE_MAX_SET){
+        regexError = "too many character classes";
+        return RE_NONE;
+    }
+    memset(reSet[reSetNum], 0, sizeof(reSet[0]));
+    return reSetNum++;
+}
+
+static void setAdd(unsigned int set, unsigned int c){
+    reSet[set][c >> 5] |= 1u << (c & 31);
+}
+
+static int setHas(unsigned int set, unsigned int c){
+    return (reSet[set][c >> 5] >> (c & 31)) & 1;
+}
+
+// add the other case of the ASCII letters in set, before a class is negated
+static void setFold(unsigned int set){
+    if (!reFold)
+        return;
+    for (unsigned int c = 'A'; c <= 'Z'; c++)
+        if (setHas(set, c) || setHas(set, c + 0x20)){
+            setAdd(set, c);
+            setAdd(set, c + 0x20);
+        }
+}
+
+static int hexValue(char c){
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief add the bytes of the escape after '\' to set, reCursor points to the
+ * character after '\'.
+ */
+static void parseEscape(unsigned int set){
+    char e = *reCursor++;
+    unsigned int c, negate = 0;
+    unsigned int tmp[8];
+
+    switch (e){
+        case 'D': negate = 1;  // fall through
+        case 'd':
+            for (c = '0'; c <= '9'; c++) setAdd(set, c);
+            break;
+        case 'W': negate = 1;  // fall through
+        case 'w':
+            for (c = 0; c < 256; c++)
+                if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+                    setAdd(set, c);
+            break;
+        case 'S': negate = 1;  // fall through
+        case 's':
+            setAdd(set, ' '); setAdd(set, '\t'); setAdd(set, '\r'); setAdd(set, '\f'); setAdd(set, '\v');
+            break;
+        case 't': setAdd(set, '\t'); break;
+        case 'r': setAdd(set, '\r'); break;
+        case 'x':
+            if (hexValue(reCursor[0]) < 0 || hexValue(reCursor[1]) < 0){
+                regexError = "bad \\x escape";
+                return;
+            }
+            setAdd(set, hexValue(reCursor[0]) * 16 + hexValue(reCursor[1]));
+            reCursor += 2;
+            break;
+        case '\0':
+            regexError = "trailing backslash";
+            reCursor--;
+            return;
+        default:
+            setAdd(set, (unsigned char)e);
+            break;
+    }
+
+    if (negate){
+        // the class escapes are added alone to a fresh set, flip it
+        memcpy(tmp, reSet[set], sizeof(tmp));
+        for (c = 0; c < 8; c++)
+            reSet[set][c] = ~tmp[c];
+    }
+}
+
+// [...], reCursor points to the character after '['
+static unsigned int parseClass(){
+    unsigned int set = newSet();
+    unsigned int negate = 0, first = 1;
+
+    if (set == RE_NONE)
+        return RE_NONE;
+    if (*reCursor == '^'){
+        negate = 1;
+        reCursor++;
+    }
+
+    while (*reCursor && (*reCursor != ']' || first)){
+        unsigned int lo = (unsigned char)*reCursor++, hi;
+        first = 0;
+
+        if (lo == '\\'){
+            unsigned int sub = newSet();
+            if (sub == RE_NONE)
+                return RE_NONE;
+            parseEscape(sub);
+            if (regexError)
+                return RE_NONE;
+            for (unsigned int w = 0; w < 8; w++)
+                reSet[set][w] |= reSet[sub][w];
+            reSetNum--;  // sub is always the last set
+            continue;
+        }
+
+        hi = lo;
+        if (reCursor[0] == '-' && reCursor[1] && reCursor[1] != ']'){
+            hi = (unsigned char)reCursor[1];
+            reCursor += 2;
+            if (hi < lo){
+                regexError = "bad range in class";
+                return RE_NONE;
+            }
+        }
+        for (unsigned int c = lo; c <= hi; c++)
+            setAdd(set, c);
+    }
+
+    if (*reCursor != ']'){
+        regexError = "missing ]";
+        return RE_NONE;
+    }
+    reCursor++;
+
+    setFold(set);
+    if (negate)
+        for (unsigned int w = 0; w < 8; w++)
+            reSet[set][w] = ~reSet[set][w];
+    reSet[set]['\n' >> 5] &= ~(1u << ('\n' & 31));  // lines are matched one by one
+
+    return newNode(RE_CHAR, set, 0);
+}
+
+static unsigned int parseAlt();
+
+static unsigned int parseAtom(){
+    unsigned int set, node;
+    char c = *reCursor++;
+
+    switch (c){
+        case '(':
+            node = parseAlt();
+            if (regexError)
+                return RE_NONE;
+            if (*reCursor != ')'){
+                regexError = "missing )";
+                return RE_NONE;
+            }
+            reCursor++;
+            return node;
+        case '[':
+            return parseClass();
+        case '^':
+            return newNode(RE_BOL, 0, 0);
+        case '$':
+            return newNode(RE_EOL, 0, 0);
+        case '*': case '+': case '?': case '{':
+            regexError = "nothing to repeat";
+            return RE_NONE;
+        case ')':
+            regexError = "unmatched )";
+            return RE_NONE;
+        default:
+            break;
+    }
+
+    set = newSet();
+    if (set == RE_NONE)
+        return RE_NONE;
+
+    if (c == '.'){
+        for (unsigned int b = 0; b < 256; b++)
+            if (b != '\n')
+                setAdd(set, b);
+    }
+    else if (c == '\\'){
+        parseEscape(set);
+        if (regexError)
+            return RE_NONE;
+    }
+    else
+        setAdd(set, (unsigned char)c);
+    setFold(set);  // the negated escapes are symmetric
+    reSet[set]['\n' >> 5] &= ~(1u << ('\n' & 31));  // lines are matched one by one
+
+    return newNode(RE_CHAR, set, 0);
+}
+
+static unsigned int parseNumber(){
+    unsigned int n = 0;
+
+    if (*reCursor < '0' || *reCursor > '9'){
+        regexError = "bad repetition";
+        return 0;
+    }
+    while (*reCursor >= '0' && *reCursor <= '9' && n <= RE_MAX_REPEAT)
+        n = n * 10 + (*reCursor++ - '0');
+    if (n > RE_MAX_REPEAT)
+        regexError = "repetition count too large";
+
+    return n;
+}
+
+static unsigned int parseRepeat(){
+    unsigned int node = parseAtom();
+
+    while (!regexError){
+        char c = *reCursor;
+        unsigned int min, max;
+
+        if (c == '*')
+            node = newNode(RE_STAR, node, 0);
+        else if (c == '+')
+            node = newNode(RE_PLUS, node, 0);
+        else if (c == '?')
+            node = newNode(RE_QUEST, node, 0);
+        else if (c == '{'){
+            reCursor++;
+            min = max = parseNumber();
+            if (*reCursor == ','){
+                reCursor++;
+                max = *reCursor == '}' ? RE_REPEAT_INF : parseNumber();
+            }
+            if (regexError)
+                return RE_NONE;
+            if (*reCursor != '}' || max < min){
+                regexError = "bad repetition";
+                return RE_NONE;
+            }
+            node = newNode(RE_REPEAT, node, 0);
+            if (node != RE_NONE){
+                reNode[node].min = min;
+                reNode[node].max = max;
+            }
+        }
+        else
+            break;
+        reCursor++;
+    }
+
+    return regexError ? RE_NONE : node;
+}
+
+static unsigned int parseCat(){
+    unsigned int node = RE_NONE;
+
+    while (*reCursor && *reCursor != '|' && *reCursor != ')'){
+        unsigned int r = parseRepeat();
+        if (regexError)
+            return RE_NONE;
+        node = node == RE_NONE ? r : newNode(RE_CAT, node, r);
+        if (regexError)
+            return RE_NONE;
+    }
+
+    return node == RE_NONE ? newNode(RE_EMPTY, 0, 0) : node;
+}
+
+static unsigned int parseAlt(){
+    unsigned int node = parseCat();
+
+    while (!regexError && *reCursor == '|'){
+        reCursor++;
+        unsigned int r = parseCat();
+        if (regexError)
+            return RE_NONE;
+        node = newNode(RE_ALT, node, r);
+    }
+
+    return regexError ? RE_NONE : node;
+}
+
+static unsigned int newNfa(unsigned int type, unsigned int set, unsigned int out, unsigned int out1){
+    if (nfaNum >= REGEX_MAX_NFA_STATE){
+        regexError = "pattern too complex (NFA)";
+        return 0;
+    }
+    nfa[nfaNum].type = type;
+    nfa[nfaNum].set = set;
+    nfa[nfaNum].out = out;
+    nfa[nfaNum].out1 = out1;
+    return nfaNum++;
+}
+
+static unsigned int emit(unsigned int node, unsigned int next);
+
+static unsigned int emitStar(unsigned int body, unsigned int next){
+    unsigned int split = newNfa(NFA_SPLIT, 0, 0, next);
+    if (regexError)
+        return 0;
+    nfa[split].out = emit(body, split);
+    return split;
+}
+
+/**
+ * @brief emit the NFA of node, continuing with the state next, and return its
+ * start state. Repetitions emit the sub-tree several times.
+ */
+static unsigned int emit(unsigned int node, unsigned int next){
+    struct reNode *n = &reNode[node];
+    unsigned int s, i;
+
+    if (regexError)
+        return 0;
+
+    switch (n->type){
+        case RE_CHAR:
+            return newNfa(NFA_CHAR, n->left, next, 0);
+        case RE_CAT:
+            return emit(n->left, emit(n->right, next));
+        case RE_ALT:
+            s = emit(n->left, next);
+            return newNfa(NFA_SPLIT, 0, s, emit(n->right, next));
+        case RE_STAR:
+            return emitStar(n->left, next);
+        case RE_PLUS:
+            s = emitStar(n->left, next);
+            return emit(n->left, s);
+        case RE_QUEST:
+            return newNfa(NFA_SPLIT, 0, emit(n->left, next), next);
+        case RE_REPEAT:
+            if (n->max == RE_REPEAT_INF)
+                s = emitStar(n->left, next);
+            else{
+                s = next;
+                for (i = n->min; i < n->max && !regexError; i++)
+                    s = newNfa(NFA_SPLIT, 0, emit(n->left, s), next);
+            }
+            for (i = 0; i < n->min && !regexError; i++)
+                s = emit(n->left, s);
+            return s;
+        case RE_BOL:
+            return newNfa(NFA_BOL, 0, next, 0);
+        case RE_EOL:
+            return newNfa(NFA_EOL, 0, next, 0);
+        default:  // RE_EMPTY
+            return next;
+    }
+}
+
+/**
+ * @brief add the epsilon closure of state s to set. '^' is passed only at the
+ * beginning of a line, '$' only at its end.
+ */
+static void closure(unsigned int *set, unsigned int s, unsigned int bol, unsigned int eol){
+    unsigned int top = 0;
+
+    if (set[s >> 5] & (1u << (s & 31)))
+        return;
+    set[s >> 5] |= 1u << (s & 31);
+    nfaStack[top++] = s;
+
+    while (top){
+        struct nfaState *st = &nfa[nfaStack[--top]];
+        unsigned int out[2], outNum = 0;
+
+        if (st->type == NFA_SPLIT){
+            out[outNum++] = st->out;
+            out[outNum++] = st->out1;
+        }
+        else if ((st->type == NFA_BOL && bol) || (st->type == NFA_EOL && eol))
+            out[outNum++] = st->out;
+
+        for (unsigned int i = 0; i < outNum; i++){
+            if (set[out[i] >> 5] & (1u << (out[i] & 31)))
+                continue;
+            set[out[i] >> 5] |= 1u << (out[i] & 31);
+            nfaStack[top++] = out[i];
+        }
+    }
+}
+
+static int inSet(const unsigned int *set, unsigned int s){
+    return (set[s >> 5] >> (s & 31)) & 1;
+}
+
+static unsigned int hashSet(const unsigned int *set){
+    unsigned int h = 2166136261u;
+    for (unsigned int w = 0; w < RE_SET_WORDS; w++)
+        h = (h ^ set[w]) * 16777619u;
+    return h % RE_HASH_SIZE;
+}
+
+// find set among the DFA states, or add it; RE_NONE if there is no room
+static unsigned int findState(struct regexDfa *dfa, const unsigned int *set){
+    unsigned int h = hashSet(set);
+
+    while (dfaHash[h] != RE_NONE){
+        if (memcmp(dfaSet[dfaHash[h]], set, sizeof(dfaSet[0])) == 0)
+            return dfaHash[h];
+        h = (h + 1) % RE_HASH_SIZE;
+    }
+
+    if (dfa->stateNum >= REGEX_MAX_STATE){
+        regexError = "pattern too complex (DFA)";
+        return RE_NONE;
+    }
+    memcpy(dfaSet[dfa->stateNum], set, sizeof(dfaSet[0]));
+    dfaHash[h] = dfa->stateNum;
+    return dfa->stateNum++;
+}
+
+// group the bytes that no character class tells apart, the DFA is built per group
+static unsigned int buildByteClasses(){
+    unsigned int classNum = 0;
+
+    for (unsigned int c = 0; c < 256; c++){
+        unsigned int k;
+        for (k = 0; k < classNum; k++){
+            unsigned int r = classRep[k], s;
+            for (s = 0; s < reSetNum; s++)
+                if (setHas(s, c) != setHas(s, r))
+                    break;
+            if (s == reSetNum)
+                break;
+        }
+        if (k == classNum)
+            classRep[classNum++] = c;
+        byteClass[c] = k;
+    }
+
+    return classNum;
+}
+
+/**
+ * @brief compile the pattern into a search DFA: every state also contains the
+ * start of the pattern, so a match can begin at any byte. If fold is not 0,
+ * the byte sets hold both cases of their ASCII letters, so the DFA matches
+ * them in either case at no cost while scanning.
+ *
+ * @return 0 on success, 1 on failure with the reason in regexError.
+ */
+int regex_compile(struct regexDfa *dfa, const char *pattern, unsigned int fold){
+    unsigned int set[RE_SET_WORDS], startSet[RE_SET_WORDS];
+    unsigned int root, match, start, classNum;
+
+    regexError = 0;
+    reCursor = pattern;
+    reNodeNum = reSetNum = nfaNum = 0;
+    reFold = fold;
+
+    if (strnlen(pattern, REGEX_MAX_LEN) >= REGEX_MAX_LEN){
+        regexError = "pattern too long";
+        return 1;
+    }
+    if (*pattern == '\0'){
+        regexError = "empty pattern";
+        return 1;
+    }
+
+    root = parseAlt();
+    if (!regexError && *reCursor)
+        regexError = "unmatched )";
+    if (regexError)
+        return 1;
+
+    match = newNfa(NFA_MATCH, 0, 0, 0);
+    start = emit(root, match);
+    if (regexError)
+        return 1;
+
+    // the restart state, then the line start state which can also pass '^'
+    memset(dfaHash, 0xff, sizeof(dfaHash));
+    dfa->stateNum = 0;
+    memset(startSet, 0, sizeof(startSet));
+    closure(startSet, start, 0, 0);
+    dfa->restart = findState(dfa, startSet);
+
+    memset(set, 0, sizeof(set));
+    closure(set, start, 1, 0);  // a superset of startSet
+    dfa->lineStart = findState(dfa, set);
+
+    if (inSet(dfaSet[dfa->restart], match) || inSet(dfaSet[dfa->lineStart], match)){
+        regexError = "pattern matches an empty string";
+        return 1;
+    }
+
+    classNum = buildByteClasses();
+
+    for (unsigned int d = 0; d < dfa->stateNum; d++){
+        // '$': a match ends at the end of the line
+        memset(set, 0, sizeof(set));
+        for (unsigned int s = 0; s < nfaNum; s++)
+            if (inSet(dfaSet[d], s))
+                closure(set, s, 0, 1);
+        dfa->eolMatch[d] = inSet(set, match);
+
+        for (unsigned int k = 0; k < classNum; k++){
+            unsigned int c = classRep[k], next;
+
+            memcpy(set, startSet, sizeof(set));
+            for (unsigned int s = 0; s < nfaNum; s++)
+                if (nfa[s].type == NFA_CHAR && inSet(dfaSet[d], s) && setHas(nfa[s].set, c))
+                    closure(set, nfa[s].out, 0, 0);
+
+            if (inSet(set, match))
+                next = dfa->restart | REGEX_MATCH;
+            else{
+                next = findState(dfa, set);
+                if (next == RE_NONE)
+                    return 1;
+            }
+
+            for (unsigned int b = 0; b < 256; b++)
+                if (byteClass[b] == k)
+                    dfa->next[d][b] = next;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief run len bytes of a line (no '\n' inside) from *state.
+ *
+ * @return the number of matches ending in these bytes.
+ */
+unsigned int regex_run(const struct regexDfa *dfa, unsigned int *state, const unsigned char *data, unsigned int len){
+    unsigned int s = *state;
+    unsigned int count = 0;
+
+    for (unsigned int i = 0; i < len; i++){
+        unsigned int v = dfa->next[s][data[i]];
+        count += v >> 15;  // REGEX_MATCH
+        s = v & (REGEX_MATCH - 1);
+    }
+
+    *state = s;
+    return count;
+}
+
+/**
+ * @brief the effect of a line fragment for every entry state, used when the
+ * state at the beginning of the fragment is not known yet. The entry states
+ * leading to the same state are merged, so the cost quickly drops to one run.
+ *
+ * @param eol 1 if the line ends right after the fragment
+ * @param map filled for the entry states 0 .. stateNum-1
+ */
+void regex_map(const struct regexDfa *dfa, const unsigned char *data, unsigned int len, unsigned int eol, struct regexMapEntry *map){
+    unsigned int liveNum = dfa->stateNum;
+    unsigned int i, g;
+
+    for (g = 0; g < dfa->stateNum; g++){
+        groupState[g] = g;
+        groupCount[g] = 0;
+        groupOf[g] = g;
+        originBase[g] = 0;
+        liveGroup[g] = g;
+        stateGroup[g] = RE_NONE;
+    }
+
+    for (i = 0; i < len && liveNum > 1; i++){
+        unsigned int keep = 0;
+
+        for (unsigned int l = 0; l < liveNum; l++){
+            unsigned int v = dfa->next[groupState[liveGroup[l]]][data[i]];
+            groupCount[liveGroup[l]] += v >> 15;
+            groupState[liveGroup[l]] = v & (REGEX_MATCH - 1);
+        }
+
+        // merge the groups in the same state, they have the same future
+        for (unsigned int l = 0; l < liveNum; l++){
+            unsigned int from = liveGroup[l];
+            unsigned int into = stateGroup[groupState[from]];
+
+            if (into == RE_NONE){
+                stateGroup[groupState[from]] = from;
+                liveGroup[keep++] = from;
+                continue;
+            }
+            for (unsigned int o = 0; o < dfa->stateNum; o++){
+                if (groupOf[o] == from){
+                    originBase[o] += (int)groupCount[from] - (int)groupCount[into];
+                    groupOf[o] = into;
+                }
+            }
+        }
+
+        liveNum = keep;
+        for (unsigned int l = 0; l < liveNum; l++)
+            stateGroup[groupState[liveGroup[l]]] = RE_NONE;
+    }
+
+    for (unsigned int l = 0; l < liveNum; l++){
+        unsigned int s = groupState[liveGroup[l]];
+
+        if (i < len)
+            groupCount[liveGroup[l]] += regex_run(dfa, &s, data + i, len - i);
+        if (eol)
+            groupCount[liveGroup[l]] += dfa->eolMatch[s];
+        groupState[liveGroup[l]] = s;
+    }
+
+    for (unsigned int o = 0; o < dfa->stateNum; o++){
+        map[o].state = groupState[groupOf[o]];
+        map[o].matches = originBase[o] + (int)groupCount[groupOf[o]];
+    }
+}
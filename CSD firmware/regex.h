@@ -0,0 +1,40 @@
+/**
+ * @file regex.h
+ * @author Lin Li
+ * @brief the regular expression operator of the in-storage search. The
+ * pattern is compiled into a table-driven DFA, matched line by line.
+ *
+ * @copyright Copyright (c) 2023 Chongqing University StarLab
+ *
+ */
+#ifndef REGEX_H_
+#define REGEX_H_
+
+#define REGEX_MAX_LEN 256  // bytes of the pattern slot in the task config, including '\0'
+#define REGEX_MAX_STATE 256  // DFA states, the compilation fails beyond this
+#define REGEX_MAX_NFA_STATE 1024
+#define REGEX_MATCH 0x8000  // set in next[][] when a match ends on this byte
+
+struct regexDfa
+{
+    unsigned int stateNum;
+    unsigned short lineStart;  // the state at the beginning of a line, '^' can match here
+    unsigned short restart;  // the state after a match, in the middle of a line
+    unsigned char eolMatch[REGEX_MAX_STATE];  // 1 if a match ends at the end of the line from this state ('$')
+    unsigned short next[REGEX_MAX_STATE][256];  // the next state, REGEX_MATCH means it is restart and a match ends here
+};
+
+// the effect of a fragment of a line for one entry state
+struct regexMapEntry
+{
+    unsigned short state;
+    unsigned short matches;
+};
+
+extern const char *regexError;
+
+int regex_compile(struct regexDfa *dfa, const char *pattern, unsigned int fold);
+unsigned int regex_run(const struct regexDfa *dfa, unsigned int *state, const unsigned char *data, unsigned int len);
+void regex_map(const struct regexDfa *dfa, const unsigned char *data, unsigned int len, unsigned int eol, struct regexMapEntry *map);
+
+#endif
@@ -6,6 +6,7 @@
  * @copyright Copyright (c) 2023 Chongqing University StarLab
  * 
  */
+#include <string.h>
 #include "xtime_l.h"
 #include "search.h"
 #include "low_level_scheduler.h"
@@ -13,8 +14,33 @@
 #include "page_map.h"
 #include "memory_map.h"
 #include "nvme/host_lld.h"
+#include "nvme/nvme_admin_cmd.h"
 
+struct searchTask* searchTaskTable;
 struct searchTask* searchTask;
+struct acAutomaton* searchAutomaton;
+struct pageBoundary* pageBoundaryRing;
+struct searchResult* searchResults;
+struct regexDfa* searchDfa;
+struct sundayTable* searchShiftTable;
+struct bitapTable* searchBitap;
+struct maskedTable* searchMasked;
+struct lineBoundary* lineBoundaryRing;
+struct searchPageMap* searchPageMap;
+struct searchQuery* searchQueryTable;
+
+static XTime lastHostIoTime;  // the last I/O command or host request to the dies
+static unsigned int queryClock;  // stamps the use of the prepared queries
+static struct searchCacheEntry* resultCache;
+static unsigned int cacheClock;  // stamps the use of the cache entries
+static struct searchTail* searchTailTable;
+static unsigned int tailClock;  // stamps the use of the tails
+
+static unsigned char stitchBuf[2 * BOUNDARY_LEN];
+static unsigned int stitchSplit;  // where the head of the next page starts in stitchBuf
+static unsigned long long matchBase;  // file offset of the buffer being matched
+
+static void finishLastLine(unsigned int searchPageIndex);
 
 void delay_ms(unsigned int mseconds){
     XTime tEnd, tCur;
@@ -37,54 +63,969 @@ void delay_us(unsigned int useconds){
 }
 
 void initSearchTask(){
-    searchTask->searchPageNum = 0;
-    searchTask->pageCompleteCount = 0;
-    searchTask->taskValid = 0;
-    searchTask->need_path_walk = 0;
-    searchTask->totalHitCounts = 0;
+    searchTaskTable = (struct searchTask*)SEARCH_TASK_ADDR;
+    searchQueryTable = (struct searchQuery*)SEARCH_QUERY_ADDR;
+    resultCache = (struct searchCacheEntry*)SEARCH_CACHE_ADDR;
+    searchTailTable = (struct searchTail*)SEARCH_TAIL_ADDR;
+
+    for (unsigned int i = 0; i < SEARCH_QUERY_NUM; i++){
+        searchQueryTable[i].valid = 0;
+        searchQueryTable[i].handle = i;
+        searchQueryTable[i].lastUse = 0;
+    }
+    for (unsigned int i = 0; i < SEARCH_CACHE_NUM; i++){
+        resultCache[i].valid = 0;
+        resultCache[i].lastUse = 0;
+    }
+    for (unsigned int i = 0; i < SEARCH_TAIL_NUM; i++){
+        searchTailTable[i].valid = 0;
+        searchTailTable[i].lastUse = 0;
+    }
+    for (unsigned int i = 0; i < SEARCH_TASK_NUM; i++){
+        searchTaskTable[i].query = 0;
+        selectSearchTask(i);
+        searchTask->taskId = i;
+        searchTask->searchPageNum = 0;
+        searchTask->pageCompleteCount = 0;
+        searchTask->taskValid = 0;
+        searchTask->need_path_walk = 0;
+        searchTask->totalHitCounts = 0;
+        searchTask->stopAfter = 0;
+        searchTask->stopped = 0;
+        searchTask->background = 0;
+        searchTask->jobState = 0;
+        searchTask->deadline = 0;
+        searchTask->retryNum = 0;
+    }
+    selectSearchTask(0);
+}
+
+/**
+ * @brief make a task of the table the one being worked on, searchTask and the
+ * tables of the matchers point to its own regions after the call.
+ *
+ * @return the id of the task selected before, to switch back to it.
+ */
+unsigned int selectSearchTask(unsigned int taskId){
+    unsigned int prev = searchTask ? searchTask->taskId : 0;
+
+    searchTask = &searchTaskTable[taskId];
+    searchAutomaton = (struct acAutomaton*)AC_AUTOMATON_ADDR + taskId;
+    pageBoundaryRing = (struct pageBoundary*)BOUNDARY_RING_ADDR + taskId * BOUNDARY_RING_SIZE;
+    searchResults = (struct searchResult*)(SEARCH_RESULT_ADDR + taskId * SEARCH_RESULT_REGION_SIZE);
+    searchDfa = (struct regexDfa*)REGEX_DFA_ADDR + taskId;
+    searchShiftTable = &searchTask->shiftTable;
+    searchBitap = &searchTask->bitap;
+    searchMasked = &searchTask->masked;
+    lineBoundaryRing = (struct lineBoundary*)LINE_BOUNDARY_ADDR + taskId * BOUNDARY_RING_SIZE;
+    searchPageMap = (struct searchPageMap*)SEARCH_PAGE_MAP_ADDR + taskId;
+    if (searchTask->query){  // the tables of a prepared query are shared by its tasks
+        searchAutomaton = &searchQueryTable[searchTask->query - 1].automaton;
+        searchDfa = &searchQueryTable[searchTask->query - 1].dfa;
+        searchShiftTable = &searchQueryTable[searchTask->query - 1].shiftTable;
+        searchBitap = &searchQueryTable[searchTask->query - 1].bitap;
+        searchMasked = &searchQueryTable[searchTask->query - 1].masked;
+    }
+
+    return prev;
+}
+
+// select a free slot of the task table for a new command, NULL if all of them are running
+struct searchTask* allocSearchTask(){
+    for (unsigned int i = 0; i < SEARCH_TASK_NUM; i++)
+        if (!searchTaskTable[i].taskValid){
+            selectSearchTask(i);
+            return searchTask;
+        }
+
+    return 0;
+}
+
+/**
+ * @brief compile the regular expression of the task into a DFA.
+ *
+ * @return the size of the pattern section, 0 if the pattern is invalid.
+ */
+static unsigned int compileRegex(char *config){
+    memcpy(searchTask->regexString, config, REGEX_MAX_LEN);
+    searchTask->regexString[REGEX_MAX_LEN - 1] = '\0';
+    searchTask->patternNum = 1;
+    searchTask->hitCounts[0] = 0;
+    searchTask->lineHitCounts = 0;
+    searchTask->boundaryLen = 0;  // the lines are stitched instead
+
+    if (searchTask->fold & MATCH_FOLD_UTF8){
+        xil_printf("[compileRegex] the UTF-8 case folding is not supported by the regex operator.\r\n");
+        return 0;
+    }
+    if (!searchTask->query && regex_compile(searchDfa, searchTask->regexString, searchTask->fold)){
+        xil_printf("[compileRegex] %s: %s\r\n", regexError, searchTask->regexString);
+        return 0;
+    }
+    for (unsigned int i = 0; i < BOUNDARY_RING_SIZE; i++)
+        lineBoundaryRing[i].pageIndex = BOUNDARY_EMPTY;
+
+    return REGEX_MAX_LEN;
+}
+
+/**
+ * @brief set up the approximate matcher of the task.
+ *
+ * @return the size of the pattern section, 0 if the pattern or k is invalid.
+ */
+static unsigned int compileApprox(char *config){
+    unsigned int k = *((unsigned int *)config);
+
+    memcpy(searchTask->approxString, config + 4, BITAP_MAX_LEN);
+    searchTask->approxString[BITAP_MAX_LEN - 1] = '\0';
+    searchTask->patternNum = 1;
+    searchTask->hitCounts[0] = 0;
+
+    if (!searchTask->query && bitap_build(searchBitap, searchTask->approxString, k, searchTask->fold)){  // built by the query
+        xil_printf("[compileApprox] invalid pattern or k (%d), the pattern should be longer than k and shorter than %d, without UTF-8 case folding.\r\n", k, BITAP_MAX_LEN);
+        return 0;
+    }
+    searchTask->patternLen[0] = searchBitap->patternLen;
+    // the state depends on the last patternLen + k bytes, the first ones of a page are matched when stitched
+    searchTask->boundaryLen = searchBitap->patternLen + searchBitap->k;
+    for (unsigned int i = 0; i < BOUNDARY_RING_SIZE; i++)
+        pageBoundaryRing[i].pageIndex = BOUNDARY_EMPTY;
+
+    return 4 + BITAP_MAX_LEN;
+}
+
+/**
+ * @brief set up the masked binary pattern of the task, it may hold any byte.
+ *
+ * @return the size of the pattern section, 0 if the pattern is invalid.
+ */
+static unsigned int compileBinary(char *config){
+    unsigned int len = *((unsigned int *)config);
+
+    if (len == 0 || len > BINARY_MAX_LEN){
+        xil_printf("[compileBinary] invalid pattern length: %d, it should between 1 and %d.\r\n", len, BINARY_MAX_LEN);
+        return 0;
+    }
+    if (searchTask->fold){
+        xil_printf("[compileBinary] binary patterns are not case folded, use the masks instead.\r\n");
+        return 0;
+    }
+
+    searchTask->patternNum = 1;
+    searchTask->hitCounts[0] = 0;
+    if (!searchTask->query)  // built by the query
+        masked_build(searchMasked, (unsigned char *)config + 4, (unsigned char *)config + 4 + len, len);
+    searchTask->patternLen[0] = len;
+    searchTask->boundaryLen = len - 1;
+    for (unsigned int i = 0; i < BOUNDARY_RING_SIZE; i++)
+        pageBoundaryRing[i].pageIndex = BOUNDARY_EMPTY;
+
+    return 4 + (2 * len + 3) / 4 * 4;
+}
+
+/**
+ * @brief load the pattern set from the task config and compile it once for
+ * the whole task. Layout: patternNum | (op << 16) | (flags << 24) (4 bytes), then patternNum
+ * slots of MAX_PATTERN_LEN bytes, each holding a '\0'-terminated string. The
+ * other operators have their own section, see SEARCH_OP_*.
+ *
+ * @return the size of the pattern section, 0 if the patterns are invalid.
+ */
+static unsigned int compileSearchTask(char *config){
+    unsigned int patternNum = *((unsigned int *)config) & 0xffff;
+    unsigned int flags = *((unsigned int *)config) >> 24;
+    unsigned int regexSize;  // of the sections of the other operators
+
+    searchTask->op = (*((unsigned int *)config) >> 16) & 0xff;
+    searchTask->fold = 0;
+    if (flags & (SEARCH_FLAG_ICASE | SEARCH_FLAG_UTF8))
+        searchTask->fold = MATCH_FOLD_ASCII;
+    if (flags & SEARCH_FLAG_UTF8)
+        searchTask->fold |= MATCH_FOLD_UTF8;
+
+    if (searchTask->op == SEARCH_OP_REGEX){
+        regexSize = compileRegex(config + 4);
+        return regexSize ? 4 + regexSize : 0;
+    }
+    if (searchTask->op == SEARCH_OP_APPROX){
+        regexSize = compileApprox(config + 4);
+        return regexSize ? 4 + regexSize : 0;
+    }
+    if (searchTask->op == SEARCH_OP_BINARY){
+        regexSize = compileBinary(config + 4);
+        return regexSize ? 4 + regexSize : 0;
+    }
+    if (searchTask->op != SEARCH_OP_LITERAL){
+        xil_printf("[compileSearchTask] unknown operator: %d\r\n", searchTask->op);
+        return 0;
+    }
+
+    if (patternNum == 0 || patternNum > MAX_PATTERN_NUM){
+        xil_printf("[compileSearchTask] invalid pattern num: %d\r\n", patternNum);
+        return 0;
+    }
+
+    searchTask->patternNum = patternNum;
+    memcpy(searchTask->targetString, config + 4, patternNum * MAX_PATTERN_LEN);
+    for (unsigned int i = 0; i < patternNum; i++){
+        searchTask->targetString[i][MAX_PATTERN_LEN - 1] = '\0';
+        searchTask->hitCounts[i] = 0;
+    }
+
+    searchTask->boundaryLen = 0;
+    for (unsigned int i = 0; i < patternNum; i++){
+        searchTask->patternLen[i] = strlen(searchTask->targetString[i]);
+        if (searchTask->patternLen[i] > searchTask->boundaryLen + 1)
+            searchTask->boundaryLen = searchTask->patternLen[i] - 1;
+    }
+    for (unsigned int i = 0; i < BOUNDARY_RING_SIZE; i++)
+        pageBoundaryRing[i].pageIndex = BOUNDARY_EMPTY;
+
+    if (patternNum == 1 && !(searchTask->fold & MATCH_FOLD_UTF8)){
+        if (!searchTask->query && sunday_build(searchShiftTable, searchTask->targetString[0], searchTask->fold)){  // built by the query
+            xil_printf("[compileSearchTask] failed to build the shift table.\r\n");
+            return 0;
+        }
+    }
+    else if (!searchTask->query && ac_build(searchAutomaton, searchTask->targetString, patternNum, searchTask->fold)){  // built by the query
+        xil_printf("[compileSearchTask] failed to build the automaton.\r\n");
+        return 0;
+    }
+
+    return 4 + patternNum * MAX_PATTERN_LEN;
+}
+
+static int queryInUse(unsigned int slot){
+    for (unsigned int i = 0; i < SEARCH_TASK_NUM; i++)
+        if (searchTaskTable[i].taskValid && searchTaskTable[i].query == slot + 1)
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief compile the stage sections in the config of the selected command into
+ * a prepared query, its automaton, DFA, shift, Bitap or masked table is built
+ * once for all the tasks bound to it. The least recently used query no task is
+ * bound to is replaced, only once the sections are compiled, so a bad pattern
+ * set leaves it alone.
+ *
+ * @return the handle of the query, SEARCH_QUERY_NONE if the sections are invalid.
+ */
+unsigned int prepareQuery(char *config){
+    struct searchQuery *query = 0;
+    unsigned int size;
+
+    if (((*((unsigned int *)config) >> 16) & 0xff) == NDP_OP_QUERY){
+        xil_printf("[prepareQuery] a query can not be bound to another one.\r\n");
+        return SEARCH_QUERY_NONE;
+    }
+    for (unsigned int i = 0; i < SEARCH_QUERY_NUM; i++)
+        if (!queryInUse(i) && (query == 0 || searchQueryTable[i].lastUse < query->lastUse))
+            query = &searchQueryTable[i];
+    if (query == 0){
+        xil_printf("[prepareQuery] all the %d prepared queries are in use.\r\n", SEARCH_QUERY_NUM);
+        return SEARCH_QUERY_NONE;
+    }
+
+    // the tables are built in the ones of the task, then moved to the query
+    size = ndpCompile(config);
+    if (size == 0 || size > SEARCH_QUERY_CONFIG_SIZE){
+        xil_printf("[prepareQuery] invalid stage sections, at most %d bytes.\r\n", SEARCH_QUERY_CONFIG_SIZE);
+        return SEARCH_QUERY_NONE;
+    }
+
+    query->handle = (query->handle + 16) & 0xffff;  // the next generation of the slot
+    memcpy(&query->automaton, searchAutomaton, sizeof(struct acAutomaton));
+    memcpy(&query->dfa, searchDfa, sizeof(struct regexDfa));
+    memcpy(&query->shiftTable, searchShiftTable, sizeof(struct sundayTable));
+    memcpy(&query->bitap, searchBitap, sizeof(struct bitapTable));
+    memcpy(&query->masked, searchMasked, sizeof(struct maskedTable));
+    memcpy(query->config, config, size);
+    query->configSize = size;
+    query->valid = 1;
+    query->lastUse = ++queryClock;
+    xil_printf("[prepareQuery] query %x is prepared.\r\n", query->handle);
+    return query->handle;
+}
+
+/**
+ * @brief bind the selected task to a prepared query, the task then uses the
+ * tables of the query instead of building its own.
+ *
+ * @return the stage sections of the query, NULL if it was replaced or never prepared.
+ */
+char *bindQuery(unsigned int handle){
+    unsigned int slot = handle & 0xf;
+    struct searchQuery *query;
+
+    if (slot >= SEARCH_QUERY_NUM || !searchQueryTable[slot].valid || searchQueryTable[slot].handle != handle){
+        xil_printf("[bindQuery] no prepared query %x, it may have been replaced.\r\n", handle);
+        searchTask->failStatus = SEARCH_SC_NO_QUERY;
+        return 0;
+    }
+
+    query = &searchQueryTable[slot];
+    query->lastUse = ++queryClock;
+    searchTask->query = slot + 1;
+    selectSearchTask(searchTask->taskId);
+    return query->config;
+}
+
+// FNV-1a
+static unsigned long long hashBytes(unsigned long long hash, const void *data, unsigned int len){
+    const unsigned char *bytes = data;
+
+    for (unsigned int i = 0; i < len; i++){
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void dropCacheEntry(struct searchCacheEntry *entry){
+    entry->valid = 0;
+    entry->lastUse = 0;
+}
+
+/**
+ * @brief look the selected path walk task up in the result cache, keyed by the
+ * file and a hash of all that shapes its results. On a hit the results are
+ * copied to the task, which completes without reading a page of the file.
+ *
+ * @param config the stage sections of the task, size bytes of them
+ * @return 1 on a hit.
+ */
+int checkResultCache(unsigned int ino, unsigned int inodeAddr, unsigned int startSec, unsigned int nlb, char *config, unsigned int size, struct searchWindow *window){
+    unsigned long long key = 0xcbf29ce484222325ULL;
+
+    if (searchTask->query){  // the sections of the query, the handle alone may name another pattern set later
+        config = searchQueryTable[searchTask->query - 1].config;
+        size = searchQueryTable[searchTask->query - 1].configSize;
+    }
+    key = hashBytes(key, config, size);
+    key = hashBytes(key, &window->offset, sizeof(window->offset));
+    key = hashBytes(key, &window->length, sizeof(window->length));
+    key = hashBytes(key, &searchTask->stopAfter, sizeof(searchTask->stopAfter));
+    key = hashBytes(key, &searchTask->resultCap, sizeof(searchTask->resultCap));
+
+    searchTask->cacheIno = ino;
+    searchTask->cacheInodeAddr = inodeAddr;
+    searchTask->cacheSec = startSec;
+    searchTask->cacheNlb = nlb;
+    searchTask->cacheKey = key;
+
+    for (unsigned int i = 0; i < SEARCH_CACHE_NUM; i++){
+        struct searchCacheEntry *entry = &resultCache[i];
+
+        if (!entry->valid || entry->ino != ino || entry->key != key)
+            continue;
+        if (entry->inodeAddr != inodeAddr || entry->startSec != startSec || entry->nlb != nlb){  // written since
+            dropCacheEntry(entry);
+            continue;
+        }
+
+        entry->lastUse = ++cacheClock;
+        searchTask->stopped = entry->stopped;
+        searchTask->totalHitCounts = entry->totalHitCounts;
+        searchTask->lineHitCounts = entry->lineHitCounts;
+        memcpy(searchTask->hitCounts, entry->hitCounts, sizeof(entry->hitCounts));
+        memcpy(searchResults, entry->results, entry->resultNum * sizeof(struct searchResult));
+        searchTask->resultNum = entry->resultNum;
+        searchTask->cacheHit = 1;
+        return 1;
+    }
+    return 0;
 }
 
-void analysisTask(unsigned int startSec, unsigned int nlb){
+// keep the results of a path walk task that searched its whole window, or stopped after stopAfter matches
+static void storeResultCache(){
+    struct searchCacheEntry *entry = 0;
+
+    if (!searchTask->cacheIno || searchTask->cacheHit || searchTask->unreadablePages || searchTask->jobState == SEARCH_JOB_FAILED
+        || (searchTask->stopped && searchTask->stopped != SEARCH_STOP_LIMIT) || searchTask->resultNum > SEARCH_CACHE_RESULT_NUM)
+        return;
+
+    for (unsigned int i = 0; i < SEARCH_CACHE_NUM && (entry == 0 || entry->valid); i++){  // the entry of the same task, or the least recently used one
+        struct searchCacheEntry *cur = &resultCache[i];
+
+        if (cur->valid && cur->ino == searchTask->cacheIno && cur->key == searchTask->cacheKey){
+            entry = cur;
+            break;
+        }
+        if (entry == 0 || cur->lastUse < entry->lastUse)
+            entry = cur;
+    }
+
+    entry->valid = 1;
+    entry->ino = searchTask->cacheIno;
+    entry->inodeAddr = searchTask->cacheInodeAddr;
+    entry->startSec = searchTask->cacheSec;
+    entry->nlb = searchTask->cacheNlb;
+    entry->key = searchTask->cacheKey;
+    entry->lastUse = ++cacheClock;
+    entry->stopped = searchTask->stopped;
+    entry->totalHitCounts = searchTask->totalHitCounts;
+    entry->lineHitCounts = searchTask->lineHitCounts;
+    memcpy(entry->hitCounts, searchTask->hitCounts, sizeof(entry->hitCounts));
+    memcpy(entry->results, searchResults, searchTask->resultNum * sizeof(struct searchResult));
+    entry->resultNum = searchTask->resultNum;
+}
+
+// a new checkpoint records the block of an inode, the results cached or being searched for an older block are stale
+void cacheSnoopInode(unsigned int ino, unsigned int inodeAddr){
+    for (unsigned int i = 0; i < SEARCH_CACHE_NUM; i++)
+        if (resultCache[i].valid && resultCache[i].ino == ino && resultCache[i].inodeAddr != inodeAddr)
+            dropCacheEntry(&resultCache[i]);
+    for (unsigned int i = 0; i < SEARCH_TASK_NUM; i++)
+        if (searchTaskTable[i].taskValid && searchTaskTable[i].cacheIno == ino && searchTaskTable[i].cacheInodeAddr != inodeAddr)
+            searchTaskTable[i].cacheIno = 0;
+}
+
+static void dropTail(struct searchTail *tail){
+    tail->valid = 0;
+    tail->lastUse = 0;
+}
+
+// the host writes the sectors [startSec, startSec + sectNum), the results cached or being searched over them are stale,
+// and so is the tail of a file whose searched blocks are written, an append only writes the block at its end
+void cacheSnoopWrite(unsigned int startSec, unsigned int sectNum){
+    for (unsigned int i = 0; i < SEARCH_TAIL_NUM; i++){
+        struct searchTail *tail = &searchTailTable[i];
+
+        if (tail->valid && startSec < tail->startSec + tail->end / SECTOR_SIZE_FTL && tail->startSec < startSec + sectNum)
+            dropTail(tail);
+    }
+    for (unsigned int i = 0; i < SEARCH_CACHE_NUM; i++){
+        struct searchCacheEntry *entry = &resultCache[i];
+
+        if (entry->valid && startSec < entry->startSec + entry->nlb && entry->startSec < startSec + sectNum)
+            dropCacheEntry(entry);
+    }
+    for (unsigned int i = 0; i < SEARCH_TASK_NUM; i++){
+        struct searchTask *task = &searchTaskTable[i];
+
+        if (task->taskValid && task->cacheIno && startSec < task->cacheSec + task->cacheNlb && task->cacheSec < startSec + sectNum)
+            task->cacheIno = 0;
+    }
+}
+
+// clip the (offset, length) window of the task to the end of the file
+void setSearchWindow(struct searchWindow *window, unsigned long long fileSize){
+    searchTask->windowStart = window->offset;
+    searchTask->windowEnd = fileSize;
+    if (window->length && window->offset + window->length < fileSize)
+        searchTask->windowEnd = window->offset + window->length;
+}
+
+static struct searchTail *findTail(unsigned int ino, unsigned int handle){
+    for (unsigned int i = 0; i < SEARCH_TAIL_NUM; i++)
+        if (searchTailTable[i].valid && searchTailTable[i].ino == ino && searchTailTable[i].handle == handle)
+            return &searchTailTable[i];
+    return 0;
+}
+
+/**
+ * @brief the selected task goes on from where the last incremental scan of
+ * the file with the same prepared query ended. The window starts there and
+ * the state at the old end (the edge of the last page, or the open line of
+ * the regex operator) is put back as page 0, already done, so the matches
+ * across the old end are found as across any two pages. Without such a
+ * scan, or if the file is now elsewhere or shorter, the whole file is
+ * searched. The window given by the host is ignored.
+ *
+ * @return 0 if the task can not be incremental, it has no prepared query.
+ */
+int continueTail(unsigned int ino, unsigned int startSec, unsigned long long fileSize){
+    struct searchTail *tail;
+
+    if (!searchTask->query){
+        xil_printf("[continueTail] an incremental task has to be bound to a prepared query.\r\n");
+        searchTask->failStatus = INVALID_FIELD_IN_COMMAND;
+        return 0;
+    }
+
+    searchTask->incremental = 1;
+    searchTask->tailIno = ino;
+    searchTask->tailSec = startSec;
+    searchTask->tailHits = 0;
+    searchTask->tailLines = 0;
+    searchTask->windowStart = 0;
+    searchTask->windowEnd = fileSize;
+
+    tail = findTail(ino, searchQueryTable[searchTask->query - 1].handle);
+    if (tail == 0)
+        return 1;
+    if (tail->startSec != startSec || tail->end > fileSize){
+        dropTail(tail);
+        return 1;
+    }
+
+    tail->lastUse = ++tailClock;
+    searchTask->windowStart = tail->end;
+    searchTask->tailHits = tail->totalHitCounts;
+    searchTask->tailLines = tail->lineHitCounts;
+    if (searchTask->op == SEARCH_OP_REGEX)
+        lineBoundaryRing[0] = tail->line;
+    else
+        pageBoundaryRing[0] = tail->edge;
+    searchPageMap->done[0] = 1;
+    searchPageMap->failed[0] = 0;
+    searchTask->searchPageNum = 1;
+    searchTask->pageCompleteCount = 1;
+    return 1;
+}
+
+// the last bytes of the scan, the tail of the last page already holds the pages before it if it is short
+static void keepEdge(struct pageBoundary *edge, unsigned int last){
+    struct pageBoundary *cur = &pageBoundaryRing[last % BOUNDARY_RING_SIZE];
+
+    edge->pageIndex = 0;
+    edge->headLen = 0;
+    edge->tailLen = 0;
+    edge->tailDone = 1;
+    edge->headOffset = searchTask->windowEnd;
+    edge->tailOffset = searchTask->windowEnd;
+    if (searchTask->searchPageNum == 0 || cur->pageIndex != last)
+        return;
+
+    memcpy(edge->tail, cur->tail, cur->tailLen);
+    edge->tailLen = cur->tailLen;
+    edge->tailOffset = cur->tailOffset;
+}
+
+// the line open at the end of the scan, a complete one if the scan ended with '\n' or has no page
+static void keepLine(struct lineBoundary *line, unsigned int last){
+    struct lineBoundary *cur = &lineBoundaryRing[last % BOUNDARY_RING_SIZE];
+
+    if (searchTask->searchPageNum && cur->pageIndex == last && cur->outKnown)
+        *line = *cur;
+    else{
+        line->outState = searchDfa->lineStart;
+        line->outMatched = 0;
+        line->outEmpty = 1;
+    }
+    line->pageIndex = 0;
+    line->headDone = 1;
+    line->outKnown = 1;
+}
+
+// keep where the incremental scan ended and the state there, unless some of the window is not searched
+static void keepTail(){
+    struct searchTail *tail;
+    unsigned int handle;
+
+    if (!searchTask->incremental || searchTask->stopped || searchTask->unreadablePages || searchTask->jobState == SEARCH_JOB_FAILED)
+        return;
+
+    handle = searchQueryTable[searchTask->query - 1].handle;
+    tail = findTail(searchTask->tailIno, handle);
+    if (tail == 0){  // the least recently used one, a free one first
+        tail = &searchTailTable[0];
+        for (unsigned int i = 1; i < SEARCH_TAIL_NUM; i++)
+            if (searchTailTable[i].lastUse < tail->lastUse)
+                tail = &searchTailTable[i];
+    }
+
+    tail->valid = 1;
+    tail->ino = searchTask->tailIno;
+    tail->handle = handle;
+    tail->lastUse = ++tailClock;
+    tail->startSec = searchTask->tailSec;
+    tail->end = searchTask->windowEnd;
+    tail->totalHitCounts = searchTask->tailHits + searchTask->totalHitCounts;
+    tail->lineHitCounts = searchTask->tailLines + searchTask->lineHitCounts;
+    if (searchTask->op == SEARCH_OP_REGEX)
+        keepLine(&tail->line, searchTask->searchPageNum - 1);
+    else
+        keepEdge(&tail->edge, searchTask->searchPageNum - 1);
+}
+
+// queue the read of a page of the task, its bits in the page map start cleared
+static void pushSearchRead(unsigned int lpn, unsigned int pageIndex, unsigned int searchStart, unsigned int searchEnd, unsigned long long offset){
     LOW_LEVEL_REQ_INFO lowLevelCmd;
-    unsigned int tempLpn = startSec / 4;
-
-    do{
-        unsigned int dieNo = tempLpn % DIE_NUM;
-        unsigned int dieLpn = tempLpn / DIE_NUM;
-        if(pageMap->pmEntry[dieNo][dieLpn].ppn != 0xffffffff){
-            lowLevelCmd.rowAddr = pageMap->pmEntry[dieNo][dieLpn].ppn;
-            lowLevelCmd.spareDataBuf = SPARE_ADDR;
-            lowLevelCmd.chNo = dieNo % CHANNEL_NUM;
-            lowLevelCmd.wayNo = dieNo / CHANNEL_NUM;
-            lowLevelCmd.request = V2FCommand_ReadPageTrigger;
-            lowLevelCmd.search = 1;
-            lowLevelCmd.searchPageIndex = searchTask->searchPageNum;
-            PushToReqQueue(&lowLevelCmd);
+    unsigned int dieNo = lpn % DIE_NUM;
+    unsigned int dieLpn = lpn / DIE_NUM;
+
+    if (ndpShareRead(lpn, pageIndex, searchStart, searchEnd, offset))  // the page is read for another one already
+        return;
+
+    lowLevelCmd.rowAddr = pageMap->pmEntry[dieNo][dieLpn].ppn;
+    lowLevelCmd.spareDataBuf = SPARE_ADDR;
+    lowLevelCmd.chNo = dieNo % CHANNEL_NUM;
+    lowLevelCmd.wayNo = dieNo / CHANNEL_NUM;
+    lowLevelCmd.request = V2FCommand_ReadPageTrigger;
+    lowLevelCmd.search = 1;
+    lowLevelCmd.searchTaskId = searchTask->taskId;
+    lowLevelCmd.searchPageIndex = pageIndex;
+    lowLevelCmd.searchLpn = lpn;
+    lowLevelCmd.searchStart = searchStart;
+    lowLevelCmd.searchEnd = searchEnd;
+    lowLevelCmd.searchOffset = offset;
+    PushToReqQueue(&lowLevelCmd);
+}
+
+static int lpnMapped(unsigned int lpn){
+    return pageMap->pmEntry[lpn % DIE_NUM][lpn / DIE_NUM].ppn != 0xffffffff;
+}
+
+static void giveUpPage(unsigned int pageIndex, unsigned long long offset, unsigned int len);
+
+/**
+ * @brief push the pages of an extent to the dies. Only the bytes of the extent
+ * that fall into the window of the task are searched, so a page shared with
+ * the neighbouring data or crossing the end of the file is masked.
+ *
+ * @param startSec the first block of the extent
+ * @param nlb the number of blocks in the extent
+ * @param fileOffset the offset of the extent in the file, in bytes
+ */
+void analysisTask(unsigned int startSec, unsigned int nlb, unsigned long long fileOffset){
+    unsigned int endSec = startSec + nlb;
+
+    for (unsigned int tempLpn = startSec / 4; 4 * tempLpn < endSec && !searchTask->stopped; tempLpn++){
+        unsigned int firstSec = 4 * tempLpn > startSec ? 4 * tempLpn : startSec;
+        unsigned int lastSec = 4 * (tempLpn + 1) < endSec ? 4 * (tempLpn + 1) : endSec;
+        unsigned int searchStart = (firstSec - 4 * tempLpn) * SECTOR_SIZE_FTL;
+        unsigned int searchEnd = (lastSec - 4 * tempLpn) * SECTOR_SIZE_FTL;
+        unsigned long long pageOffset = fileOffset + (unsigned long long)(firstSec - startSec) * SECTOR_SIZE_FTL;  // file offset of searchStart
+
+        if (pageOffset >= searchTask->windowEnd)
+            break;
+        if (pageOffset + (searchEnd - searchStart) <= searchTask->windowStart)
+            continue;
+
+        if (pageOffset < searchTask->windowStart)
+        {
+            searchStart += searchTask->windowStart - pageOffset;
+            pageOffset = searchTask->windowStart;
+        }
+        if (pageOffset + (searchEnd - searchStart) > searchTask->windowEnd)
+            searchEnd -= pageOffset + (searchEnd - searchStart) - searchTask->windowEnd;
+
+        unsigned int pageIndex = searchTask->searchPageNum++;
+        if (pageIndex < MAX_SEARCH_PAGE_NUM && pageIndex % 32 == 0){
+            searchPageMap->done[pageIndex / 32] = 0;
+            searchPageMap->failed[pageIndex / 32] = 0;
         }
+
+        if(lpnMapped(tempLpn))
+            pushSearchRead(tempLpn, pageIndex, searchStart, searchEnd, pageOffset);
         else{
             xil_printf("lpn %d not has ppn!\r\n", tempLpn);
-            searchTask->pageCompleteCount++;
+            giveUpPage(pageIndex, pageOffset, searchEnd - searchStart);
         }
-
-        searchTask->searchPageNum++;
-    } while (4 * (++tempLpn) < startSec + nlb);
+    }
 
     reservedReq = 1;
 }
 
-void CheckTaskDone(){
-    if(searchTask->pageCompleteCount < searchTask->searchPageNum)
+static struct searchRetry *findRetry(unsigned int pageIndex){
+    for (unsigned int i = 0; i < searchTask->retryNum; i++)
+        if (searchTask->retry[i].pageIndex == pageIndex)
+            return &searchTask->retry[i];
+    return 0;
+}
+
+/**
+ * @brief account a page of the selected task as done, a page is counted once
+ * however it comes back, so that the task completes neither early nor never.
+ *
+ * @return 1 if the page was not done yet, 0 if it is already accounted.
+ */
+int markPageDone(unsigned int pageIndex){
+    struct searchRetry *retry;
+
+    if (pageIndex < MAX_SEARCH_PAGE_NUM){
+        unsigned int bit = 1u << (pageIndex % 32);
+
+        if (searchPageMap->done[pageIndex / 32] & bit)
+            return 0;
+        searchPageMap->done[pageIndex / 32] |= bit;
+    }
+    if (searchTask->retryNum && (retry = findRetry(pageIndex)) != 0)  // read on a retry or given up
+        *retry = searchTask->retry[--searchTask->retryNum];
+    searchTask->pageCompleteCount++;
+    return 1;
+}
+
+/**
+ * @brief keep the file bytes [start, end) as unreadable, merged with the range
+ * it touches. Once the ranges are full, the nearest one is stretched over it,
+ * so the host may read a few readable bytes again but never misses one.
+ */
+static void addUnreadable(unsigned long long start, unsigned long long end){
+    struct searchRange *nearest = 0;
+    unsigned long long nearestGap = 0;
+
+    for (unsigned int i = 0; i < searchTask->unreadableNum; i++){
+        struct searchRange *range = &searchTask->unreadable[i];
+        unsigned long long gap = start > range->end ? start - range->end : range->start > end ? range->start - end : 0;
+
+        if (nearest == 0 || gap < nearestGap){
+            nearest = range;
+            nearestGap = gap;
+        }
+    }
+
+    if (nearest == 0 || (nearestGap && searchTask->unreadableNum < SEARCH_UNREADABLE_NUM)){
+        searchTask->unreadable[searchTask->unreadableNum].start = start;
+        searchTask->unreadable[searchTask->unreadableNum].end = end;
+        searchTask->unreadableNum++;
         return;
+    }
+    if (start < nearest->start)
+        nearest->start = start;
+    if (end > nearest->end)
+        nearest->end = end;
+}
 
-    XTime_GetTime(&time_end_search);
+// the page of the selected task can not be read, it is searched as a page without data and reported to the host
+static void giveUpPage(unsigned int pageIndex, unsigned long long offset, unsigned int len){
+    if (pageIndex < MAX_SEARCH_PAGE_NUM)
+        searchPageMap->failed[pageIndex / 32] |= 1u << (pageIndex % 32);
+    if (len && !searchTask->stopped){
+        addUnreadable(offset, offset + len);
+        searchTask->unreadablePages++;
+    }
+    ndpSkipPage(pageIndex);
+}
+
+/**
+ * @brief a search read failed after the retries of the scheduler. The page is
+ * read again from FeedSearchTasks() up to SEARCH_RETRY_LIMIT times, so the
+ * other pages go on meanwhile, then it is given up as unreadable.
+ */
+void failSearchPage(unsigned int taskId, unsigned int lpn, unsigned int pageIndex, unsigned int searchStart, unsigned int searchEnd, unsigned long long offset){
+    unsigned int prev = selectSearchTask(taskId);
+    struct searchRetry *retry = findRetry(pageIndex);
+
+    xil_printf("[search task %d] the read of page %d failed.\r\n", taskId, pageIndex);
+    if (searchTask->stopped)
+        markPageDone(pageIndex);  // not searched anyway
+    else if (retry ? retry->tries >= SEARCH_RETRY_LIMIT : searchTask->retryNum == SEARCH_RETRY_NUM)
+        giveUpPage(pageIndex, offset, searchEnd - searchStart);
+    else{
+        if (retry == 0){
+            retry = &searchTask->retry[searchTask->retryNum++];
+            retry->lpn = lpn;
+            retry->pageIndex = pageIndex;
+            retry->searchStart = searchStart;
+            retry->searchEnd = searchEnd;
+            retry->offset = offset;
+            retry->tries = 0;
+        }
+        retry->queued = 0;
+    }
+    selectSearchTask(prev);
+}
+
+// queue the reads of the failed pages again, they are already counted in searchPageNum
+static void retryPages(){
+    for (unsigned int i = searchTask->retryNum; i-- > 0;){  // a page given up is replaced by the last one
+        struct searchRetry *retry = &searchTask->retry[i];
 
-    // all the pages are done, return response to host
+        if (retry->queued || !ndpSlotFree(retry->lpn % DIE_NUM))
+            continue;
+        if (!lpnMapped(retry->lpn)){
+            giveUpPage(retry->pageIndex, retry->offset, retry->searchEnd - retry->searchStart);
+            continue;
+        }
+        retry->queued = 1;
+        retry->tries++;
+        pushSearchRead(retry->lpn, retry->pageIndex, retry->searchStart, retry->searchEnd, retry->offset);
+    }
+}
+
+/**
+ * @brief put the unreadable ranges of the task after its matches, ended by a
+ * range of length 0, so the host reads only them again. They take the place
+ * of the last matches if the results are full.
+ */
+static void reportUnreadable(){
+    unsigned int num = 1, first = searchTask->resultNum;
+
+    if (searchTask->unreadableNum == 0 || searchTask->resultCap == 0)
+        return;
+    for (unsigned int i = 0; i < searchTask->unreadableNum; i++)
+        for (unsigned long long start = searchTask->unreadable[i].start; start < searchTask->unreadable[i].end; start += SEARCH_RANGE_MAX)
+            num++;
+    if (num > searchTask->resultCap)
+        num = searchTask->resultCap;
+    if (first + num > searchTask->resultCap)
+        first = searchTask->resultCap - num;
+
+    searchTask->resultNum = first;
+    for (unsigned int i = 0; i < searchTask->unreadableNum; i++){
+        struct searchRange *range = &searchTask->unreadable[i];
+
+        for (unsigned long long start = range->start; start < range->end && searchTask->resultNum < first + num - 1; start += SEARCH_RANGE_MAX){
+            searchResults[searchTask->resultNum].offset = start;
+            searchResults[searchTask->resultNum].patternId = SEARCH_UNREADABLE_ID;
+            searchResults[searchTask->resultNum].length = range->end - start < SEARCH_RANGE_MAX ? range->end - start : SEARCH_RANGE_MAX;
+            searchTask->resultNum++;
+        }
+    }
+    searchResults[searchTask->resultNum].offset = 0;
+    searchResults[searchTask->resultNum].patternId = SEARCH_UNREADABLE_ID;
+    searchResults[searchTask->resultNum].length = 0;
+    searchTask->resultNum++;
+    searchTask->trailerResults = searchTask->resultNum - first;
+}
+
+/**
+ * @brief put the tail result of an incremental task before the unreadable
+ * ranges: the offset its scans reached and their hits in length, so the host
+ * gets the cumulative counts along with the ones of this scan in dword0.
+ * The last match makes room for it if the results are full.
+ */
+static void reportTail(){
+    struct searchTail *tail;
+    unsigned int at = searchTask->resultNum - searchTask->trailerResults;
+
+    if (!searchTask->incremental || searchTask->resultCap == 0)
+        return;
+    if (searchTask->resultNum == searchTask->resultCap){
+        if (at == 0)
+            return;
+        at--;
+    }
+    else{
+        memmove(&searchResults[at + 1], &searchResults[at], searchTask->trailerResults * sizeof(struct searchResult));
+        searchTask->resultNum++;
+    }
+
+    tail = findTail(searchTask->tailIno, searchQueryTable[searchTask->query - 1].handle);
+    searchResults[at].offset = tail ? tail->end : 0;
+    searchResults[at].patternId = SEARCH_TAIL_ID;
+    searchResults[at].length = !tail ? 0 : searchTask->op == SEARCH_OP_REGEX ? tail->lineHitCounts : tail->totalHitCounts;
+    searchTask->trailerResults++;
+}
+
+// the matches counted against stopAfter and returned as results
+static unsigned int taskMatchNum(){
+    return searchTask->op == SEARCH_OP_REGEX ? searchTask->lineHitCounts : searchTask->totalHitCounts;
+}
+
+// the status code the selected task completes with, and its dword0: the matches returned as results
+// (one per matching line for regex, so the host never reads past the results stored) and the flags
+static unsigned int taskStatus(unsigned int *specific){
+    *specific = taskMatchNum() & ~SEARCH_RESULT_FLAGS;
+    if (searchTask->jobState == SEARCH_JOB_FAILED)
+        return searchTask->failStatus ? searchTask->failStatus : INTERNAL_DEVICE_ERROR;
+    if (searchTask->stopped == SEARCH_STOP_CANCEL)
+        return COMMAND_ABORT_REQUESTED;
+    if (searchTask->stopped == SEARCH_STOP_TIMEOUT)
+        return SEARCH_SC_TIMEOUT;
+
+    if (searchTask->resultNum - searchTask->trailerResults < taskMatchNum())
+        *specific |= SEARCH_RESULT_OVERFLOW;
+    if (searchTask->incremental)
+        *specific |= SEARCH_RESULT_INCREMENTAL;
+    if (searchTask->unreadablePages)
+        *specific |= SEARCH_RESULT_UNREADABLE;
+    if (searchTask->stopped == SEARCH_STOP_LIMIT)
+        *specific |= SEARCH_RESULT_STOPPED;
+    return 0;
+}
+
+// DMA the results to the 4KB units of the command from firstUnit on, up to unitNum of them
+static void txResults(unsigned int cmdSlotTag, unsigned int firstUnit, unsigned int unitNum){
+    unsigned int resultSize = searchTask->resultNum * sizeof(struct searchResult);
+    unsigned int i;
+
+    for (i = 0; i * 4096 < resultSize && i < unitNum; i++)
+        set_auto_tx_dma(cmdSlotTag, firstUnit + i, (unsigned int)searchResults + i * 4096);
+    if (i)
+        check_auto_tx_dma_done();
+}
+
+// send the results to the 4KB units of the command from firstUnit on, and complete it with the match counts in dword0
+static void sendResults(unsigned int cmdSlotTag, unsigned int firstUnit){
     NVME_COMPLETION nvmeCPL;
+    unsigned int specific;
+
     nvmeCPL.dword[0] = 0x0;
-    set_auto_nvme_cpl(searchTask->cmdSlotTag, 0x0, nvmeCPL.statusFieldWord);
-    
-    searchTask->taskValid = 0;
-    xil_printf("[ search task done, total hit counts: %d ]\r\n", searchTask->totalHitCounts);
+    nvmeCPL.statusField.SC = taskStatus(&specific);
+    if (nvmeCPL.statusField.SC == 0)  // no results when the task failed
+        txResults(cmdSlotTag, firstUnit, 256 - firstUnit);
+    set_auto_nvme_cpl(cmdSlotTag, specific, nvmeCPL.statusFieldWord);
+}
+
+// a task whose command completed early is done, tell the host which log page holds its results
+static void notifyTaskDone(){
+    post_async_event(ASYNC_EVENT_VENDOR, searchTask->taskId, SEARCH_LOG_PAGE + searchTask->taskId);
+}
+
+/**
+ * @brief stop the selected task, the reads not issued yet and the pages
+ * waiting for the compute are dropped, so its staging slots are free again.
+ * The reads in flight are still waited for but not searched.
+ */
+static void stopTask(unsigned int reason){
+    if (!searchTask->stopped){
+        searchTask->pageCompleteCount += CancelSearchReq(searchTask->taskId) + ndpCancel(searchTask->taskId);
+        for (unsigned int i = searchTask->retryNum; i-- > 0;)
+            if (!searchTask->retry[i].queued)
+                markPageDone(searchTask->retry[i].pageIndex);
+    }
+    searchTask->stopped = reason;
+}
+
+static void checkDeadline(){
+    XTime tCur;
+
+    if (searchTask->deadline == 0 || searchTask->stopped || searchTask->jobState != SEARCH_JOB_RUN)
+        return;
+    XTime_GetTime(&tCur);
+    if (tCur >= searchTask->deadline)
+        stopTask(SEARCH_STOP_TIMEOUT);
+}
+
+static const char *stopReason[] = {"", ", stopped early", ", cancelled", ", timed out"};
+
+static void checkOneTask(){
+    if(!searchTask->taskValid || searchTask->rxDmaExe)
+        return;
+    checkDeadline();
+    if (searchTask->pageCompleteCount < searchTask->searchPageNum)
+        return;
+    // a task is done once all its pages are queued, and only once
+    if (searchTask->jobState != SEARCH_JOB_RUN || (!searchTask->stopped && (searchTask->jobNlb || searchTask->jobExtent)))
+        return;
+
+    XTime_GetTime(&time_end_search);
+
+    ndpFinish();
+    storeResultCache();
+    keepTail();
+    reportUnreadable();
+    reportTail();
+
+    // all the pages are done, send the results back after the task config, a job keeps them until it is polled
+    if (searchTask->background && searchTask->stopped != SEARCH_STOP_CANCEL){
+        searchTask->jobState = SEARCH_JOB_DONE;
+        notifyTaskDone();
+    }
+    else{
+        if (!searchTask->background)
+            sendResults(searchTask->cmdSlotTag, searchTask->configUnit);
+        searchTask->taskValid = 0;
+    }
+    xil_printf("[ search task %d done, total hit counts: %d, %d results returned%s%s ]\r\n", searchTask->taskId, searchTask->totalHitCounts, searchTask->resultNum,
+               stopReason[searchTask->stopped], searchTask->cacheHit ? ", from the result cache" : "");
+    if (searchTask->op == SEARCH_OP_REGEX)
+        xil_printf("  %s: %d, line hits: %d\r\n", searchTask->regexString, searchTask->hitCounts[0], searchTask->lineHitCounts);
+    else if (searchTask->op == SEARCH_OP_APPROX)
+        xil_printf("  %s (k = %d): %d\r\n", searchTask->approxString, searchBitap->k, searchTask->hitCounts[0]);
+    else if (searchTask->op == SEARCH_OP_BINARY)
+        xil_printf("  binary pattern of %d bytes: %d\r\n", searchTask->patternLen[0], searchTask->hitCounts[0]);
+    else
+        for (unsigned int i = 0; i < searchTask->patternNum; i++)
+            xil_printf("  %s: %d\r\n", searchTask->targetString[i], searchTask->hitCounts[i]);
+    if (searchTask->unreadablePages)
+        xil_printf("  %d pages unreadable in %d ranges\r\n", searchTask->unreadablePages, searchTask->unreadableNum);
+    if (searchTask->incremental)
+        xil_printf("  incremental, %d hits since the first scan\r\n", searchTask->tailHits + searchTask->totalHitCounts);
 
     if (searchTask->need_path_walk){
 		unsigned int t_total, tUsed;
@@ -94,66 +1035,518 @@ void CheckTaskDone(){
     }
 }
 
+// complete the tasks of the table whose pages are all done
+void CheckTaskDone(){
+    for (unsigned int i = 0; i < SEARCH_TASK_NUM; i++){
+        selectSearchTask(i);
+        checkOneTask();
+    }
+}
+
 // to abort the task in some special situations.
 inline void abort_task(){
-    set_auto_nvme_cpl(searchTask->cmdSlotTag, 0x0, 0x0);
+    NVME_COMPLETION nvmeCPL;
+
+    if (searchTask->background){  // its command is already completed, the failure is reported to the poll
+        searchTask->jobState = SEARCH_JOB_FAILED;
+        notifyTaskDone();
+        return;
+    }
+    nvmeCPL.dword[0] = 0x0;
+    nvmeCPL.statusField.SC = searchTask->failStatus;  // 0 unless the host can act on it, e.g. SEARCH_SC_NO_QUERY
+    set_auto_nvme_cpl(searchTask->cmdSlotTag, 0x0, nvmeCPL.statusFieldWord);
     
     searchTask->taskValid = 0;
 }
 
-// find the position of temp in target.
-int Sunday_FindIndex(char *target,char temp){
-    for(int i = strlen(target) -1;i>=0;i--){
-        if(target[i] == temp)
-            return i;
+// an I/O command or a request to the dies other than a search read, the background jobs pause
+void markHostBusy(){
+    XTime_GetTime(&lastHostIoTime);
+}
+
+static int hostIdle(unsigned int idleMs){
+    XTime tCur;
+
+    XTime_GetTime(&tCur);
+    return tCur - lastHostIoTime >= ((XTime) idleMs) * (COUNTS_PER_SECOND / 1000);
+}
+
+// queue the next pages of the selected task, at most inflight of them are left in the queues
+static void feedTask(unsigned int inflight){
+    if (searchTask->retryNum && !searchTask->stopped)
+        retryPages();
+    while (searchTask->searchPageNum - searchTask->pageCompleteCount < inflight && !searchTask->stopped){
+        if (searchTask->jobNlb == 0 || searchTask->jobOffset >= searchTask->windowEnd){
+            struct addressBlock *extent = searchTask->jobExtent;
+
+            if (extent == 0 || searchTask->jobOffset >= searchTask->windowEnd){  // all the pages are queued
+                searchTask->jobNlb = 0;
+                searchTask->jobExtent = 0;
+                return;
+            }
+            searchTask->jobSec = extent->blockAddr;
+            searchTask->jobNlb = extent->blockNum;
+            searchTask->jobExtentNum--;
+            searchTask->jobExtent = extent->endFlag || searchTask->jobExtentNum == 0 ? 0 : extent + 1;
+            continue;
+        }
+
+        // the page waits in the task until its die has a free staging slot, the compute never holds up a read
+        if (!ndpSlotFree(searchTask->jobSec / 4 % DIE_NUM))
+            return;
+
+        // up to the end of the page, so that each page is queued once
+        unsigned int nlb = 4 - searchTask->jobSec % 4;
+        if (nlb > searchTask->jobNlb)
+            nlb = searchTask->jobNlb;
+        analysisTask(searchTask->jobSec, nlb, searchTask->jobOffset);
+        searchTask->jobSec += nlb;
+        searchTask->jobNlb -= nlb;
+        searchTask->jobOffset += (unsigned long long)nlb * SECTOR_SIZE_FTL;
     }
-    return -1;  // failed to find
 }
 
-// the string search function, based on Sunday algorithm.
-unsigned int Sunday(char *source,char *target){
-    int i= 0,j = 0,srclen = 16384,tarlen=strlen(target);
-    int temp  = 0,index = -1;
-	int count = 0;
+/**
+ * @brief queue the next pages of the running tasks, called between the passes
+ * of the scheduler so that the host commands (a cancel included) are served
+ * during a long scan. The background jobs are started and fed only while the
+ * host is idle.
+ */
+void FeedSearchTasks(){
+    for (unsigned int i = 0; i < SEARCH_TASK_NUM; i++){
+        struct searchTask *task = &searchTaskTable[i];
+
+        if (!task->taskValid || (task->jobState != SEARCH_JOB_WAIT && task->jobState != SEARCH_JOB_RUN))
+            continue;
+        if (task->background && !hostIdle(task->idleMs))
+            continue;
 
-    while(i < srclen){
-        if(source[i] == target[j]){
-            if(j == tarlen - 1){
-                i++; j=0; count++;  // match successfully
+        unsigned int prev = selectSearchTask(i);
+        if (task->jobState == SEARCH_JOB_WAIT){
+            XTime_GetTime(&time_start_search);
+            StartSearchTask();
+        }
+        else
+            feedTask(task->idleMs ? SEARCH_JOB_INFLIGHT : SEARCH_TASK_INFLIGHT);
+        selectSearchTask(prev);
+    }
+}
+
+/**
+ * @brief the host cancels its tasks, the pages not searched yet are dropped
+ * and each task completes with COMMAND_ABORT_REQUESTED once its reads in
+ * flight are back. A background job that is not running is freed at once.
+ *
+ * @return the number of the tasks cancelled.
+ */
+unsigned int cancelSearchTasks(unsigned int tag){
+    unsigned int num = 0;
+
+    for (unsigned int i = 0; i < SEARCH_TASK_NUM; i++){
+        struct searchTask *task = &searchTaskTable[i];
+
+        if (!task->taskValid || task->tag != tag || task->stopped == SEARCH_STOP_CANCEL)
+            continue;
+        num++;
+        if (task->background && (task->jobState == SEARCH_JOB_WAIT || task->jobState == SEARCH_JOB_DONE || task->jobState == SEARCH_JOB_FAILED)){
+            task->taskValid = 0;
+            continue;
+        }
+
+        unsigned int prev = selectSearchTask(i);
+        stopTask(SEARCH_STOP_CANCEL);
+        selectSearchTask(prev);
+    }
+    return num;
+}
+
+/**
+ * @brief the host polls a background job, the results of a finished job are
+ * sent to the command from its first 4KB unit on, then the job is freed.
+ *
+ * @return 1 if the command is completed here, 0 if the job is still running,
+ * -1 if there is no such job or it failed.
+ */
+int pollSearchJob(unsigned int jobId, unsigned int cmdSlotTag){
+    int ret = 0;
+
+    if (jobId >= SEARCH_TASK_NUM || !searchTaskTable[jobId].taskValid || !searchTaskTable[jobId].background
+        || searchTaskTable[jobId].rxDmaExe)
+        return -1;
+
+    unsigned int prev = selectSearchTask(jobId);
+    if (searchTask->jobState == SEARCH_JOB_FAILED){
+        searchTask->taskValid = 0;
+        ret = -1;
+    }
+    else if (searchTask->jobState == SEARCH_JOB_DONE){
+        sendResults(cmdSlotTag, 0);
+        searchTask->taskValid = 0;
+        ret = 1;
+    }
+    selectSearchTask(prev);
+
+    return ret;
+}
+
+/**
+ * @brief the host reads the results log page of a task after its asynchronous
+ * event, the first 4KB unit is a struct searchLog and the results follow, as
+ * many as the bytes asked for hold. A finished task is freed once read.
+ */
+void readSearchLog(unsigned int taskId, unsigned int cmdSlotTag, unsigned int bytes){
+    struct searchLog *log = (struct searchLog *)(SEARCH_LOG_ADDR + taskId * 4096);
+    struct searchTask *task = &searchTaskTable[taskId];
+
+    log->state = 0;
+    log->status = 0;
+    log->specific = 0;
+    log->resultNum = 0;
+    log->totalHitCounts = 0;
+    if (task->taskValid && task->background && !task->rxDmaExe){
+        unsigned int prev = selectSearchTask(taskId);
+
+        log->state = searchTask->jobState;
+        if (searchTask->jobState == SEARCH_JOB_DONE || searchTask->jobState == SEARCH_JOB_FAILED){
+            log->status = taskStatus(&log->specific);
+            if (log->status == 0){
+                log->resultNum = searchTask->resultNum;
+                log->totalHitCounts = searchTask->totalHitCounts;
+            }
+        }
+        set_auto_tx_dma(cmdSlotTag, 0, (unsigned int)log);
+        if (log->resultNum && bytes > 4096)
+            txResults(cmdSlotTag, 1, (bytes - 4096 + 4095) / 4096);
+        if (log->state == SEARCH_JOB_DONE || log->state == SEARCH_JOB_FAILED)
+            searchTask->taskValid = 0;
+        selectSearchTask(prev);
+    }
+    else
+        set_auto_tx_dma(cmdSlotTag, 0, (unsigned int)log);
+    check_auto_tx_dma_done();
+
+    set_auto_nvme_cpl(cmdSlotTag, 0x0, 0x0);
+}
+
+// keep a match for the host, the ones past the cap are only counted
+static void recordMatch(unsigned long long offset, unsigned int patternId){
+    if (searchTask->resultNum >= searchTask->resultCap)
+        return;
+
+    searchResults[searchTask->resultNum].offset = offset;
+    searchResults[searchTask->resultNum].patternId = patternId;
+    searchResults[searchTask->resultNum].length = 0;
+    searchTask->resultNum++;
+}
+
+static void pageMatchHook(unsigned int pos, unsigned int patternId){
+    recordMatch(matchBase + pos, patternId);
+}
+
+// only the matches starting in the tail of the previous page and ending in the head of the next one
+static void stitchMatchHook(unsigned int pos, unsigned int patternId){
+    if (pos >= stitchSplit || pos + searchTask->patternLen[patternId] <= stitchSplit)
+        return;
+
+    searchTask->hitCounts[patternId]++;
+    searchTask->totalHitCounts++;
+    recordMatch(matchBase + pos, patternId);
+}
+
+// run the task's engine over a buffer, the hits of each pattern are added to hitCounts
+static unsigned int matchBuffer(const unsigned char *data, unsigned int len, unsigned int *hitCounts, matchHook hook){
+    unsigned int hitCount;
+
+    if (searchTask->op == SEARCH_OP_BINARY){
+        hitCount = masked_search(searchMasked, data, len, hook);
+        hitCounts[0] += hitCount;
+    }
+    else if (searchTask->patternNum == 1 && !(searchTask->fold & MATCH_FOLD_UTF8)){  // the automaton folds UTF-8
+        hitCount = sunday_search(searchShiftTable, data, len, hook);
+        hitCounts[0] += hitCount;
+    }
+    else
+        hitCount = ac_search(searchAutomaton, data, len, hitCounts, hook);
+
+    return hitCount;
+}
+
+/**
+ * @brief count the matches that start in prev and end in next, by matching
+ * tail(prev) + head(next) and keeping the ones crossing the split. prev may
+ * have no byte (a skipped page), and the tail of a short prev also holds the
+ * pages before it, so a match may start there too.
+ */
+static void stitchPages(struct pageBoundary *prev, struct pageBoundary *next){
+    unsigned int scratch[MAX_PATTERN_NUM];  // the engine counts every match here, the hook keeps the crossing ones
+    unsigned int hitCount;
+
+    if (next->headLen == 0)
+        return;
+
+    memset(scratch, 0, sizeof(scratch));
+    memcpy(stitchBuf, prev->tail, prev->tailLen);
+    memcpy(stitchBuf + prev->tailLen, next->head, next->headLen);
+    stitchSplit = prev->tailLen;
+    matchBase = prev->tailLen ? prev->tailOffset : next->headOffset;  // prev may be a skipped page
+
+    if (searchTask->op == SEARCH_OP_APPROX){
+        // the tail only sets up the state, every match starting a run in the head is counted here
+        hitCount = bitap_search(searchBitap, stitchBuf, prev->tailLen + next->headLen, prev->tailLen,
+                searchTask->resultNum < searchTask->resultCap ? pageMatchHook : 0);
+        searchTask->hitCounts[0] += hitCount;
+        searchTask->totalHitCounts += hitCount;
+        return;
+    }
+
+    matchBuffer(stitchBuf, prev->tailLen + next->headLen, scratch, stitchMatchHook);
+}
+
+/**
+ * @brief a page shorter than the edge only has all of its bytes in its tail,
+ * the end of the tail of the page before is put in front of them, so that a
+ * match crossing the short page is still found with the page after.
+ */
+static void carryTail(struct pageBoundary *prev, struct pageBoundary *cur){
+    unsigned int more = searchTask->boundaryLen - cur->tailLen;
+
+    cur->tailDone = 1;
+    if (prev->tailOffset + prev->tailLen != cur->tailOffset)  // e.g. a skipped page, nothing to carry
+        return;
+    if (more > prev->tailLen)
+        more = prev->tailLen;
+    memmove(cur->tail + more, cur->tail, cur->tailLen);
+    memcpy(cur->tail, prev->tail + prev->tailLen - more, more);
+    cur->tailLen += more;
+    cur->tailOffset -= more;
+}
+
+/**
+ * @brief the tail of page prev is complete, stitch it to the pages after it
+ * that are already done, and go on through the short ones whose tail waited
+ * for it.
+ */
+static void stitchForward(struct pageBoundary *prev){
+    while (1){
+        struct pageBoundary *next = &pageBoundaryRing[(prev->pageIndex + 1) % BOUNDARY_RING_SIZE];
+
+        if (next->pageIndex != prev->pageIndex + 1)
+            return;
+        stitchPages(prev, next);
+        if (next->tailDone)  // stitched to its own next page already if that one is done
+            return;
+        carryTail(prev, next);
+        prev = next;
+    }
+}
+
+/**
+ * @brief keep the edges of a finished page and stitch it to the neighbours that
+ * are already done. Pages complete out of order across the dies, so whichever
+ * page of a pair finishes second does the stitching. A page shorter than the
+ * edge waits for the tail of the page before it, so its own tail covers the
+ * bytes a match may span before the page after.
+ */
+static void finishPage(unsigned int searchPageIndex, const unsigned char *data, unsigned int len, unsigned long long offset){
+    struct pageBoundary *cur, *prev;
+    unsigned int edgeLen = len < searchTask->boundaryLen ? len : searchTask->boundaryLen;
+
+    if (searchTask->boundaryLen == 0)
+        return;  // only single-byte patterns, nothing can span two pages
+
+    cur = &pageBoundaryRing[searchPageIndex % BOUNDARY_RING_SIZE];
+    if (cur->pageIndex != BOUNDARY_EMPTY && cur->pageIndex + BOUNDARY_RING_SIZE != searchPageIndex)
+        xil_printf("[finishPage] boundary slot of page %d is still held by page %d!\r\n", searchPageIndex, cur->pageIndex);
+
+    cur->pageIndex = searchPageIndex;
+    cur->headLen = edgeLen;
+    cur->tailLen = edgeLen;
+    memcpy(cur->head, data, edgeLen);
+    memcpy(cur->tail, data + len - edgeLen, edgeLen);
+    cur->headOffset = offset;
+    cur->tailOffset = offset + len - edgeLen;
+    cur->tailDone = searchPageIndex == 0 || len == 0 || len >= searchTask->boundaryLen;  // a skipped page breaks the chain
+
+    if (searchPageIndex > 0){
+        prev = &pageBoundaryRing[(searchPageIndex - 1) % BOUNDARY_RING_SIZE];
+        if (prev->pageIndex == searchPageIndex - 1 && prev->tailDone){
+            stitchPages(prev, cur);
+            if (!cur->tailDone)
+                carryTail(prev, cur);
+        }
+    }
+
+    if (cur->tailDone)
+        stitchForward(cur);
+}
+
+// a line of the regex task is complete, the host gets the offset of each matching line
+static void countLine(unsigned int matches, unsigned int matched, unsigned long long lineStart){
+    searchTask->hitCounts[0] += matches;
+    searchTask->totalHitCounts += matches;
+    if (matches || matched){
+        searchTask->lineHitCounts++;
+        recordMatch(lineStart, 0);
+    }
+}
+
+/**
+ * @brief account the bytes before the first '\n' of the pages whose entry
+ * state is known, starting from searchPageIndex and going on with the pages
+ * after it. A page without '\n' passes the open line on to the next one.
+ */
+static void resolveLines(unsigned int searchPageIndex){
+    struct lineBoundary *cur, *prev;
+
+    while (1){
+        cur = &lineBoundaryRing[searchPageIndex % BOUNDARY_RING_SIZE];
+        if (cur->pageIndex != searchPageIndex)
+            return;
+
+        if (!cur->headDone){
+            unsigned int state = searchDfa->lineStart, matched = 0, empty = 1;
+            unsigned long long lineStart = cur->offset;
+
+            if (searchPageIndex > 0){
+                prev = &lineBoundaryRing[(searchPageIndex - 1) % BOUNDARY_RING_SIZE];
+                if (prev->pageIndex != searchPageIndex - 1 || !prev->outKnown)
+                    return;
+                state = prev->outState;
+                matched = prev->outMatched;
+                empty = prev->outEmpty;
+                lineStart = empty ? cur->offset : prev->outLineStart;  // also right after a skipped page
             }
-			else{
-                i++;j++;
-            }	
-        }else{  // unequal positions found
-            temp = tarlen - j + i;  // the position of the first character after the source string
-            index = Sunday_FindIndex(target,source[temp]);
-            if(index==-1){ // not find the position, go forward
-                i = temp+1;
-                j = 0;
-            }else{  // find the position
-                i = temp-index;
-                j = 0;
+
+            struct regexMapEntry *e = &cur->head[state];
+            if (cur->hasNewline)
+                countLine(e->matches, matched, lineStart);
+            else{
+                searchTask->hitCounts[0] += e->matches;
+                searchTask->totalHitCounts += e->matches;
+                cur->outState = e->state;
+                cur->outMatched = matched || e->matches;
+                cur->outEmpty = empty && cur->outEmpty;  // set in regexInPage if the page has no byte
+                cur->outLineStart = lineStart;
+                cur->outKnown = 1;
             }
+            cur->headDone = 1;
         }
+
+        if (!cur->outKnown)
+            return;
+        searchPageIndex++;
     }
-    return count;
 }
 
-// perform the string searching
-void searchInPage(unsigned int pageDataBufAddr, unsigned int searchPageIndex){
-    unsigned int hitCount = 0;
+/**
+ * @brief the regex operator. The complete lines of the page are matched from
+ * the line start state, the bytes before the first '\n' are mapped for every
+ * entry state until the page before is done.
+ */
+static void regexInPage(unsigned int searchPageIndex, const unsigned char *data, unsigned int len, unsigned long long offset){
+    struct lineBoundary *cur = &lineBoundaryRing[searchPageIndex % BOUNDARY_RING_SIZE];
+    const unsigned char *end = data + len;
+    const unsigned char *line = len ? memchr(data, '\n', len) : 0;
 
-    /*
-    * This is the version without hardware accelerators, and we provide a KMP-based function
-    * for string searching instead. However, due to the limitation of hardware computing power
-    * bottleneck, the time cost of this function may be relatively large. Considering that this
-    * is not the focus of FSR, the delay function is used to simulate the effect of hardware
-    * accelerators.
-    */
+    if (cur->pageIndex != BOUNDARY_EMPTY && cur->pageIndex + BOUNDARY_RING_SIZE != searchPageIndex)
+        xil_printf("[regexInPage] boundary slot of page %d is still held by page %d!\r\n", searchPageIndex, cur->pageIndex);
 
-    // hitCount = Sunday((char*)pageDataBufAddr, searchTask->targetString);
-    delay_us(50);
+    cur->pageIndex = searchPageIndex;
+    cur->offset = offset;
+    cur->hasNewline = line != 0;
+    cur->headDone = 0;
+    cur->outKnown = 0;
+    cur->outEmpty = len == 0;
+    regex_map(searchDfa, data, line ? line - data : len, line != 0, cur->head);
 
-    searchTask->totalHitCounts += hitCount;
-    searchTask->pageCompleteCount++;
+    while (line){
+        const unsigned char *next;
+        unsigned int state = searchDfa->lineStart;
+        unsigned int matches;
+
+        line++;
+        next = memchr(line, '\n', end - line);
+        matches = regex_run(searchDfa, &state, line, (next ? next : end) - line);
+        if (next)
+            countLine(matches + searchDfa->eolMatch[state], 0, offset + (line - data));
+        else{
+            searchTask->hitCounts[0] += matches;
+            searchTask->totalHitCounts += matches;
+            cur->outState = state;
+            cur->outMatched = matches > 0;
+            cur->outEmpty = line == end;
+            cur->outLineStart = offset + (line - data);
+            cur->outKnown = 1;
+        }
+        line = next;
+    }
+
+    resolveLines(searchPageIndex);
 }
+
+// the last line of the file may not end with '\n'
+static void finishLastLine(unsigned int searchPageIndex){
+    struct lineBoundary *last = &lineBoundaryRing[searchPageIndex % BOUNDARY_RING_SIZE];
+
+    if (last->pageIndex != searchPageIndex || !last->outKnown || last->outEmpty)
+        return;
+    countLine(searchDfa->eolMatch[last->outState], last->outMatched, last->outLineStart);
+}
+
+/**
+ * @brief enough matches are found, drop the reads of the task that are not
+ * issued yet. The ones in flight are still waited for but not searched.
+ */
+static void checkStop(){
+    if (searchTask->stopAfter == 0 || searchTask->stopped || taskMatchNum() < searchTask->stopAfter)
+        return;
+
+    stopTask(SEARCH_STOP_LIMIT);
+}
+
+// perform the string searching over the searched bytes of a page, all the patterns of the task are matched in one pass
+static void searchPage(struct ndpStage *stage, unsigned int searchPageIndex, const unsigned char *data, unsigned int len, unsigned long long searchOffset){
+    if (searchTask->op == SEARCH_OP_REGEX){
+        regexInPage(searchPageIndex, data, len, searchOffset);
+        checkStop();
+        return;
+    }
+
+    matchHook hook = searchTask->resultNum < searchTask->resultCap ? pageMatchHook : 0;  // only count once the results are full
+
+    matchBase = searchOffset;
+    if (searchTask->op == SEARCH_OP_APPROX){
+        // the first boundaryLen bytes are counted when stitched to the page before
+        unsigned int hitCount = bitap_search(searchBitap, data, len, searchPageIndex ? searchTask->boundaryLen : 0, hook);
+        searchTask->hitCounts[0] += hitCount;
+        searchTask->totalHitCounts += hitCount;
+    }
+    else
+        searchTask->totalHitCounts += matchBuffer(data, len, searchTask->hitCounts, hook);
+    finishPage(searchPageIndex, data, len, searchOffset);
+    checkStop();
+}
+
+// a page without data (e.g. an unmapped lpn), it breaks the chain of stitched pages
+static void searchSkip(struct ndpStage *stage, unsigned int searchPageIndex){
+    static const unsigned char newline = '\n';
+
+    if (searchTask->op == SEARCH_OP_REGEX)
+        regexInPage(searchPageIndex, &newline, 1, 0);
+    else
+        finishPage(searchPageIndex, 0, 0, 0);
+    checkStop();
+}
+
+static unsigned int searchInit(struct ndpStage *stage, char *config){
+    return compileSearchTask(config);
+}
+
+// the last line of an incremental task is only counted once it ends with '\n', it goes on in the next scan
+static void searchFinish(struct ndpStage *stage){
+    if (searchTask->op == SEARCH_OP_REGEX && searchTask->searchPageNum && !searchTask->incremental)
+        finishLastLine(searchTask->searchPageNum - 1);
+}
+
+// the search is the last stage of its pipeline, its state is searchTask and the tables around it
+const struct ndpOperator searchOperator = {"search", searchInit, searchPage, searchSkip, searchFinish, 1};
@@ -9,8 +9,75 @@
 #ifndef SEARCH_H_
 #define SEARCH_H_
 #include "xtime_l.h"
+#include "match.h"
+#include "regex.h"
+#include "ndp.h"
 
-#define MAX_SEARCH_PAGE_NUM 10*1024*1024/16  // the num of pages containeed in 10GB
+#define MAX_SEARCH_PAGE_NUM (10*1024*1024/16)  // the num of pages containeed in 10GB, the pages of a task past it are counted without the page map
+
+#define SEARCH_TASK_NUM 3  // tasks running at the same time, each one has its own state, config and result regions
+
+#define BOUNDARY_RING_SIZE 2048  // must cover the pages in flight, 2 * DIE_NUM * REQ_QUEUE_DEPTH
+#define BOUNDARY_LEN BINARY_MAX_LEN  // the edge kept for stitching, the longest match minus one or patternLen + k of an approximate match
+#define BOUNDARY_EMPTY 0xffffffff
+
+// the operator of a task, in bits 16-23 of the first word of the config
+#define SEARCH_OP_LITERAL 0  // up to MAX_PATTERN_NUM strings
+#define SEARCH_OP_REGEX 1  // one regular expression in a REGEX_MAX_LEN slot, matched line by line
+#define SEARCH_OP_APPROX 2  // k (4 bytes), then one pattern in a BITAP_MAX_LEN slot, matched within k edits
+#define SEARCH_OP_BINARY 3  // patternLen (4 bytes), the pattern and its byte mask (patternLen bytes each), padded to 4 bytes
+
+// the flags of a task, in bits 24-31 of the first word of the config
+#define SEARCH_FLAG_ICASE 0x1  // the ASCII letters match in either case, not for SEARCH_OP_BINARY
+#define SEARCH_FLAG_UTF8 0x2  // so do the 2-byte UTF-8 letters (simple case folding), only for SEARCH_OP_LITERAL
+
+#define SEARCH_QUERY_NUM 8  // prepared queries kept on the device, at most 16, the least recently used one no task is bound to is replaced
+#define SEARCH_QUERY_CONFIG_SIZE (3 * 4096)  // bytes of the stage sections of a prepared query
+#define SEARCH_QUERY_NONE 0xffffffff
+#define SEARCH_SC_NO_QUERY 0xC1  // status code of a task bound to a query that was replaced or never prepared
+
+#define SEARCH_CACHE_NUM 16  // results of the path walk tasks kept, the least recently used entry is replaced
+#define SEARCH_CACHE_RESULT_NUM 4096  // the results of an entry, a task with more is not cached
+
+#define SEARCH_TAIL_NUM 16  // files scanned incrementally with a prepared query, the least recently used one is replaced
+#define SEARCH_TAIL_ID 0xfffffffe  // patternId of the tail result of an incremental task: the offset its scans reached, their hits in length
+
+#define SEARCH_WINDOW_INCREMENTAL 0x1  // in the flags of the window, the scan goes on from where the last one of the file with the same prepared query ended
+
+#define SEARCH_CONFIG_MAX_UNIT 128  // 4KB units of the task config, given in dword13 of the command, about 43K extents
+
+#define SEARCH_RESULT_MAX_NUM(configUnit) ((256 - (configUnit)) * 4096 / sizeof(struct searchResult))  // the 4KB units after the config
+#define SEARCH_RESULT_OVERFLOW 0x80000000  // set in dword0 of the completion if some results are dropped
+#define SEARCH_RESULT_STOPPED 0x40000000  // set in dword0 if the task stopped after stopAfter matches, the counts only cover the pages searched
+#define SEARCH_RESULT_PENDING 0x20000000  // set in dword0 of a poll if the background job is not done yet
+#define SEARCH_RESULT_UNREADABLE 0x10000000  // set in dword0 if some pages could not be read, their ranges are the last results, up to one of length 0
+#define SEARCH_RESULT_INCREMENTAL 0x08000000  // set in dword0 of an incremental task, its tail result comes right before the unreadable ranges
+#define SEARCH_RESULT_FLAGS (SEARCH_RESULT_OVERFLOW | SEARCH_RESULT_STOPPED | SEARCH_RESULT_PENDING | SEARCH_RESULT_UNREADABLE | SEARCH_RESULT_INCREMENTAL)
+
+#define SEARCH_UNREADABLE_ID 0xffffffff  // patternId of a result that is a range of the file not searched because it could not be read
+#define SEARCH_UNREADABLE_NUM 64  // unreadable ranges kept per task, past it a range is merged into the nearest one
+#define SEARCH_RANGE_MAX 0x80000000  // bytes in the length of one unreadable result, a longer range takes several
+#define SEARCH_RETRY_NUM 32  // failed pages of a task waiting to be read again, past it a failed page is given up at once
+#define SEARCH_RETRY_LIMIT 2  // times a failed page is read again, each read already has RETRY_LIMIT retries in the scheduler
+
+#define SEARCH_LOG_PAGE 0xC0  // the log page of the results of task i is SEARCH_LOG_PAGE + i, named in the asynchronous event
+
+// the states of a background job, its pages are only queued while the host is idle
+#define SEARCH_JOB_WAIT 1  // the config is in, the job waits for the host to be idle
+#define SEARCH_JOB_RUN 2  // its pages are being queued and searched
+#define SEARCH_JOB_DONE 3  // the results wait for the host to poll them
+#define SEARCH_JOB_FAILED 4
+
+#define SEARCH_JOB_IDLE_MS 100  // the host is idle after this long without I/O, unless the job gives its own in dword15
+#define SEARCH_JOB_INFLIGHT DIE_NUM  // pages of a job queued at a time, so that it pauses soon after the host comes back
+#define SEARCH_TASK_INFLIGHT (DIE_NUM * NDP_SLOT_NUM)  // pages of a task queued at a time, the next ones are queued between the passes of the scheduler
+
+// why a task stopped before all its pages were searched
+#define SEARCH_STOP_LIMIT 1  // stopAfter matches are found
+#define SEARCH_STOP_CANCEL 2  // cancelled by the host, completes with COMMAND_ABORT_REQUESTED
+#define SEARCH_STOP_TIMEOUT 3  // past its deadline, completes with SEARCH_SC_TIMEOUT
+#define SEARCH_SC_TIMEOUT 0xC0  // status code of a task past its deadline, vendor specific in the generic command status
+#define SEARCH_SC_BUSY 0xC2  // status code of a task sent while all SEARCH_TASK_NUM slots are running, DNR is clear so the host tries again later
 
 struct addressBlock
 {
@@ -19,46 +86,246 @@ struct addressBlock
     unsigned int endFlag;
 };
 
+// the part of the file to search, follows the patterns in the task config
+struct searchWindow
+{
+    unsigned long long offset;  // in bytes from the start of the file
+    unsigned long long length;  // 0 for up to the end of the file
+    unsigned long long fileSize;  // from the host, only used when the extents are given by the host
+    unsigned int timeoutMs;  // the task is stopped this long after it starts, 0 for never
+    unsigned int flags;  // SEARCH_WINDOW_*
+};
+
+// a pattern set compiled once, the tasks bound to it parse its sections again but share its tables
+struct searchQuery
+{
+    unsigned int valid;
+    unsigned int handle;  // the slot in bits 0-3 and a generation above, so the handle of a replaced query is refused
+    unsigned int lastUse;  // for the LRU, 0 if not valid
+    unsigned int configSize;
+    char config[SEARCH_QUERY_CONFIG_SIZE];  // the stage sections
+    struct acAutomaton automaton;
+    struct regexDfa dfa;
+    struct sundayTable shiftTable;
+    struct bitapTable bitap;
+    struct maskedTable masked;
+};
+
+// the first 4KB unit of the results log page, the results follow in the next units
+struct searchLog
+{
+    unsigned int state;  // SEARCH_JOB_* of the task, 0 if there is no such task
+    unsigned int status;  // the NVMe status code the task completed with, 0 on success
+    unsigned int specific;  // the match counts and the SEARCH_RESULT_* flags, as in dword0 of the completion
+    unsigned int resultNum;
+    unsigned int totalHitCounts;  // every match, a regex line matching several times counts each of them
+};
+
+// a match reported to the host, DMA'd back after the task config
+struct searchResult
+{
+    unsigned long long offset;  // where the match starts in the file
+    unsigned int patternId;  // SEARCH_UNREADABLE_ID for an unreadable range
+    unsigned int length;  // the bytes of an unreadable range, 0 for a match
+};
+
+// the results of a task over a file, a repeat of the task completes after the path walk without reading the file
+struct searchCacheEntry
+{
+    unsigned int valid;
+    unsigned int ino;
+    unsigned int inodeAddr;  // the block of the inode when cached, a changed inode is written elsewhere
+    unsigned int startSec;  // the blocks of the file, a write into them makes the entry stale
+    unsigned int nlb;
+    unsigned long long key;  // hash of the stage sections, the window, stopAfter and resultCap
+    unsigned int lastUse;
+    unsigned int stopped;  // SEARCH_STOP_LIMIT or 0
+    unsigned int totalHitCounts;
+    unsigned int lineHitCounts;
+    unsigned int hitCounts[MAX_PATTERN_NUM];
+    unsigned int resultNum;
+    struct searchResult results[SEARCH_CACHE_RESULT_NUM];
+};
+
+// the pages of a task already accounted and the ones given up as unreadable, a bit per searchPageIndex
+struct searchPageMap
+{
+    unsigned int done[MAX_SEARCH_PAGE_NUM / 32];
+    unsigned int failed[MAX_SEARCH_PAGE_NUM / 32];
+};
+
+// a page whose read failed, read again from FeedSearchTasks()
+struct searchRetry
+{
+    unsigned int lpn;
+    unsigned int pageIndex;
+    unsigned int searchStart : 16;
+    unsigned int searchEnd : 16;
+    unsigned int tries : 8;  // the reads issued again so far
+    unsigned int queued : 1;  // the read is in the queues
+    unsigned int reserved : 23;
+    unsigned long long offset;  // file offset of searchStart
+};
+
+// the file bytes [start, end) that could not be read
+struct searchRange
+{
+    unsigned long long start;
+    unsigned long long end;
+};
+
+// the edges of a searched page, kept until its neighbours have been stitched to it
+struct pageBoundary
+{
+    unsigned int pageIndex;  // searchPageIndex of the owner, BOUNDARY_EMPTY if not searched yet
+    unsigned int headLen;
+    unsigned int tailLen;
+    unsigned int tailDone;  // tail holds the last boundaryLen bytes up to the end of the page, those of the pages before included
+    unsigned long long headOffset;  // file offset of head[0]
+    unsigned long long tailOffset;  // file offset of tail[0]
+    unsigned char head[BOUNDARY_LEN];  // the first bytes of the page
+    unsigned char tail[BOUNDARY_LEN];  // the last bytes of the page, and of the pages before for a page shorter than the edge
+};
+
+// the line open at the edges of a page, for the regex operator
+struct lineBoundary
+{
+    unsigned int pageIndex;  // searchPageIndex of the owner, BOUNDARY_EMPTY if not searched yet
+    unsigned int hasNewline : 1;
+    unsigned int headDone : 1;  // the bytes before the first '\n' are accounted
+    unsigned int outKnown : 1;  // the out* fields are valid
+    unsigned int outMatched : 1;  // the line open at the end of the page already has a match
+    unsigned int outEmpty : 1;  // and it has no byte yet
+    unsigned int reserved : 27;
+    unsigned int outState;  // the DFA state at the end of the page
+    unsigned long long outLineStart;  // file offset of the line open at the end of the page
+    unsigned long long offset;  // file offset of the first searched byte
+    struct regexMapEntry head[REGEX_MAX_STATE];  // the effect of the bytes before the first '\n', for every entry state
+};
+
+// where the last incremental scan of a file with a prepared query ended, the next one goes on from there
+struct searchTail
+{
+    unsigned int valid;
+    unsigned int ino;
+    unsigned int handle;  // of the prepared query
+    unsigned int lastUse;  // for the LRU, 0 if not valid
+    unsigned int startSec;  // the first block of the file, a file written elsewhere is searched again
+    unsigned long long end;  // the file bytes before it are searched
+    unsigned int totalHitCounts;  // of all the scans up to end
+    unsigned int lineHitCounts;
+    struct pageBoundary edge;  // the last bytes before end, page 0 of the next scan
+    struct lineBoundary line;  // the line open at end for the regex operator, page 0 of the next scan
+};
+
 struct searchTask
 {
+    unsigned int taskId;  // the slot in the task table
     unsigned int cmdSlotTag;
     unsigned int taskValid;
     unsigned int need_path_walk;
     unsigned int totalHitCounts;
     unsigned int searchPageNum;
     unsigned int pageCompleteCount;
-    char targetString[32];
+    unsigned int op;  // SEARCH_OP_*
+    unsigned int fold;  // MATCH_FOLD_*, from the SEARCH_FLAG_* of the task
+    unsigned int patternNum;
+    char targetString[MAX_PATTERN_NUM][MAX_PATTERN_LEN];
+    unsigned int patternLen[MAX_PATTERN_NUM];
+    unsigned int hitCounts[MAX_PATTERN_NUM];  // per-pattern hits, indexed like targetString
+    struct sundayTable shiftTable;  // used instead of the automaton when there is only one pattern
+    struct bitapTable bitap;  // for SEARCH_OP_APPROX
+    struct maskedTable masked;  // for SEARCH_OP_BINARY
+    char approxString[BITAP_MAX_LEN];
+    char regexString[REGEX_MAX_LEN];
+    unsigned int lineHitCounts;  // lines with at least one match, for the regex operator
+    unsigned int boundaryLen;  // bytes carried over between adjacent pages, the longest match minus one (patternLen + k for SEARCH_OP_APPROX)
+    unsigned long long windowStart;  // the file bytes [windowStart, windowEnd) are searched
+    unsigned long long windowEnd;
+    unsigned int configUnit;  // 4KB units of the task config, the results follow it
+    unsigned int resultCap;  // the results the host can take, from dword11 of the command
+    unsigned int resultNum;  // the results stored in SEARCH_RESULT_ADDR
+    struct ndpPipeline pipeline;  // the stages of the task, built from the config
+    unsigned int stopAfter;  // stop once this many matches (lines for the regex operator) are found, from dword14 of the command, 0 for never
+    unsigned int stopped;  // SEARCH_STOP_*, the pages not read yet are dropped, 0 while the task runs
+    unsigned int tag;  // given by the host in dword12 to cancel the task, the pid of the application with FSRLib
+    XTime deadline;  // when the task is stopped, 0 for never
+    unsigned int background;  // a job run while the host is idle, its command completes once the config is in
+    unsigned int jobState;  // SEARCH_JOB_*, a foreground task is SEARCH_JOB_RUN once started
+    unsigned int failStatus;  // the status code a failed task completes with, 0 for the default
+    unsigned int prepare;  // the config is a pattern set to prepare as a query, not a task
+    unsigned int query;  // 1 + the prepared query the task is bound to, 0 if it built its own tables
+    unsigned int cacheIno;  // the file of a path walk task whose results can be cached, 0 if not
+    unsigned int cacheInodeAddr;
+    unsigned int cacheSec;  // the blocks of the file
+    unsigned int cacheNlb;
+    unsigned long long cacheKey;
+    unsigned int cacheHit;  // the results come from the result cache, no page is read
+    unsigned int incremental;  // the task goes on from the tail of its file, SEARCH_WINDOW_INCREMENTAL
+    unsigned int tailIno;
+    unsigned int tailSec;  // the first block of the file
+    unsigned int tailHits;  // the hits of the scans before, up to windowStart
+    unsigned int tailLines;
+    unsigned int idleMs;  // the idle time the job waits for before its pages are queued, 0 for an asynchronous task
+    unsigned int jobSec;  // the blocks of the extent being queued, for all the tasks
+    unsigned int jobNlb;
+    unsigned long long jobOffset;  // file offset of jobSec
+    struct addressBlock *jobExtent;  // the next extent to queue, in the task config, NULL after the last one
+    unsigned int jobExtentNum;  // the extents from jobExtent on, from the count in the config
+    struct searchRetry retry[SEARCH_RETRY_NUM];  // the failed pages not given up yet
+    unsigned int retryNum;
+    struct searchRange unreadable[SEARCH_UNREADABLE_NUM];  // the pages given up, merged into ranges
+    unsigned int unreadableNum;
+    unsigned int unreadablePages;
+    unsigned int trailerResults;  // the results after the matches: the tail of an incremental task and the unreadable ranges
 
     unsigned int  rxDmaExe : 1;
 	unsigned int  rxDmaTail : 8;
 	unsigned int  rxDmaOverFlowCnt;
     unsigned int  reserved1 : 23;
-
-    // struct targetPage
-    // {
-    //     unsigned int done;
-    //     unsigned int hitCount;
-    // };
-    // struct targetPage pageTable[MAX_SEARCH_PAGE_NUM];
 };
 
 XTime time_start_search, time_end_search;
 XTime time_start_retrieve, time_end_retrieve;
 
-extern struct searchTask* searchTask;
+extern struct searchTask* searchTaskTable;
+extern struct searchTask* searchTask;  // the task being worked on, the tables below are its own
+extern struct acAutomaton* searchAutomaton;
+extern struct pageBoundary* pageBoundaryRing;
+extern struct searchResult* searchResults;
+extern struct regexDfa* searchDfa;
+extern struct sundayTable* searchShiftTable;
+extern struct bitapTable* searchBitap;
+extern struct maskedTable* searchMasked;
+extern struct lineBoundary* lineBoundaryRing;
+extern struct searchPageMap* searchPageMap;
+extern struct searchQuery* searchQueryTable;
+extern const struct ndpOperator searchOperator;
 
 void delay_ms(unsigned int mseconds);
 void delay_us(unsigned int useconds);
 
 void initSearchTask();
+unsigned int selectSearchTask(unsigned int taskId);
+struct searchTask* allocSearchTask();
 
-void analysisTask(unsigned int startSec, unsigned int nlb);
+unsigned int prepareQuery(char *config);
+char *bindQuery(unsigned int handle);
+int checkResultCache(unsigned int ino, unsigned int inodeAddr, unsigned int startSec, unsigned int nlb, char *config, unsigned int size, struct searchWindow *window);
+void cacheSnoopInode(unsigned int ino, unsigned int inodeAddr);
+void cacheSnoopWrite(unsigned int startSec, unsigned int sectNum);
+
+void setSearchWindow(struct searchWindow *window, unsigned long long fileSize);
+int continueTail(unsigned int ino, unsigned int startSec, unsigned long long fileSize);
+void analysisTask(unsigned int startSec, unsigned int nlb, unsigned long long fileOffset);
+int markPageDone(unsigned int pageIndex);
+void failSearchPage(unsigned int taskId, unsigned int lpn, unsigned int pageIndex, unsigned int searchStart, unsigned int searchEnd, unsigned long long offset);
 void CheckTaskDone();
+void markHostBusy();
+void FeedSearchTasks();
+int pollSearchJob(unsigned int jobId, unsigned int cmdSlotTag);
+void readSearchLog(unsigned int taskId, unsigned int cmdSlotTag, unsigned int bytes);
+unsigned int cancelSearchTasks(unsigned int tag);
 void abort_task();
 
-int Sunday_FindIndex(char *target, char temp);
-unsigned int Sunday(char *source, char *target);
-
-void searchInPage(unsigned int pageDataBufAddr, unsigned int searchPageIndex);
-
 #endif
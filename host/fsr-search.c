@@ -6,21 +6,126 @@
 
 #include "fsrlib.h"
 
-int main(int argc, char const *argv[])
+int main(int argc, char *argv[])
 {
-    if(argc != 2){
-        printf ("Usage: fsr-search file_path(started from /).\n");
+    unsigned long long offset = 0, length = 0;
+    unsigned int max_results = 1024, stop_after = 0;
+    int background = 0, async = 0, log_task = -1;
+    unsigned int idle_ms = 0, timeout_ms = 0;
+    int regex = 0, binary = 0, k = -1;
+    int prepare = 0, query = -1, incremental = 0;
+    unsigned int flags = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:l:n:m:b:t:c:ag:pq:frk:xiu")) != -1) {
+        if (opt == 'o')
+            offset = strtoull(optarg, NULL, 0);
+        else if (opt == 'l')
+            length = strtoull(optarg, NULL, 0);
+        else if (opt == 'n')
+            max_results = strtoul(optarg, NULL, 0);
+        else if (opt == 'm')
+            stop_after = strtoul(optarg, NULL, 0);  // stop after that many matches, 1 to only ask whether there is one
+        else if (opt == 'b'){
+            background = 1;  // a background job, searched while the host is idle for idle_ms (0 for the default)
+            idle_ms = strtoul(optarg, NULL, 0);
+        }
+        else if (opt == 'a')
+            async = 1;  // only submit the task, its results are read with -g
+        else if (opt == 'g')
+            log_task = atoi(optarg);  // read the results of a task submitted with -a or -b
+        else if (opt == 't')
+            timeout_ms = strtoul(optarg, NULL, 0);  // the task fails if it runs longer
+        else if (opt == 'c'){  // cancel the tasks of another fsr-search
+            int num = cancel_task("/dev/nvme0n1", strtoul(optarg, NULL, 0));
+            if (num > 0)
+                printf("%d tasks cancelled.\n", num);
+            return num > 0 ? 0 : 1;
+        }
+        else if (opt == 'p')
+            prepare = 1;  // only prepare the patterns as a query, no file is searched
+        else if (opt == 'q')
+            query = strtoul(optarg, NULL, 0);  // search with a prepared query, the patterns only name the results
+        else if (opt == 'f')
+            incremental = 1;  // only search what was appended since the last -f of the query over the file
+        else if (opt == 'r')
+            regex = 1;  // the first pattern is a regular expression
+        else if (opt == 'k')
+            k = atoi(optarg);  // the first pattern is matched within k edits
+        else if (opt == 'x')
+            binary = 1;  // the first pattern is binary, in hex
+        else if (opt == 'i')
+            flags |= SEARCH_FLAG_ICASE;
+        else if (opt == 'u')
+            flags |= SEARCH_FLAG_ICASE | SEARCH_FLAG_UTF8;
+        else
+            argc = 0;  // print the usage
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (log_task >= 0){  // the patterns, if given, name the results
+        struct fsr_result *results = (struct fsr_result *)malloc(max_results * sizeof(struct fsr_result));
+        __u32 total;
+        int result_num = read_task_log("/dev/nvme0n1", log_task, results, max_results, &total);
+        if (result_num == FSR_JOB_PENDING)
+            printf("task %d is not done yet.\n", log_task);
+        else if (result_num >= 0)
+            print_results(results, result_num, total, argc > 1 ? (const char **)(argv + 1) : NULL);
+        free(results);
+        return result_num >= 0 ? 0 : 1;
+    }
+
+    if(argc < 2){
+        printf ("Usage: fsr-search [-o offset] [-l length] [-n max_results] [-m stop_after] [-a | -b idle_ms] [-t timeout_ms] [-q query [-f] | -r | -k edits | -x] [-i | -u] file_path(started from /) [pattern ...], or fsr-search -p [-r | -k edits | -x] [-i | -u] pattern ..., or fsr-search -c pid, or fsr-search -g task_id [pattern ...].\n");
         return 1;
     }
+    if (prepare){  // the arguments are the patterns
+        argc++;
+        argv--;
+    }
+
+    const char *default_target[1] = {"hello"};
+    const char **targets = argc > 2 ? (const char **)(argv + 2) : default_target;
+    unsigned int target_num = argc > 2 ? argc - 2 : 1;
+
+    unsigned char pattern[BINARY_MAX_LEN], mask[BINARY_MAX_LEN];
+    unsigned int binary_len = binary ? parse_hex_pattern(targets[0], pattern, mask) : 0;
+    if (binary && binary_len == 0)
+        return 1;
 
-    int buf_size = 16 + 4 + 256;  // 16 for target_str, 4 for path_len, 256 for path
+    // patterns, 32 for the window, 4 for path_len, 256 for path
+    int buf_size = MAX_PATTERN_SECTION + 32 + 4 + 256;
     char *buf_start = (char *)malloc(buf_size);
     memset(buf_start, 0, buf_size);
     char * buf_index = buf_start;
 
-    char target[16] = "hello";
-    memcpy(buf_index, target, 16);
-    buf_index += 16;
+    unsigned int pattern_size = query >= 0 ? put_query(buf_index, query) :
+                                regex ? put_regex(buf_index, targets[0]) :
+                                binary ? put_binary(buf_index, pattern, mask, binary_len) :
+                                k >= 0 ? put_approx(buf_index, targets[0], k) : put_patterns(buf_index, targets, target_num);
+    if (pattern_size == 0)
+        return 1;
+    if (query < 0)
+        set_search_flags(buf_index, flags);
+    if (prepare){
+        int handle = prepare_query("/dev/nvme0n1", buf_index, pattern_size);
+        if (handle < 0)
+            return 1;
+        printf("query %d prepared, search with it by: fsr-search -q %d file_path\n", handle, handle);
+        return 0;
+    }
+    buf_index += pattern_size;
+
+    // the firmware takes the file size from the inode
+    if (incremental && query < 0){
+        printf("an incremental search (-f) needs a prepared query (-q)!\n");
+        return 1;
+    }
+    unsigned int window_size = put_window(buf_index, offset, length, 0, timeout_ms);
+    if (incremental)
+        set_incremental(buf_index);
+    buf_index += window_size;
 
     int path_len = strlen(argv[1]);
     if (path_len > 256){
@@ -31,8 +136,31 @@ int main(int argc, char const *argv[])
     buf_index += 4;
     // printf("path len: %d\n", path_len);
     memcpy(buf_index, argv[1], path_len);
+    buf_index += path_len;
 
-    issue_task("/dev/nvme0n1", buf_start, buf_size, 1);
+    struct fsr_result *results = (struct fsr_result *)malloc(max_results * sizeof(struct fsr_result));
+    __u32 total;
+    int result_num;
+    if (async){
+        int task = submit_task("/dev/nvme0n1", buf_start, buf_index - buf_start, 1, max_results, stop_after);
+        if (task < 0)
+            return 1;
+        printf("task %d submitted, read its results with: fsr-search -g %d\n", task, task);
+        return 0;
+    }
+    if (background){
+        int job = submit_job("/dev/nvme0n1", buf_start, buf_index - buf_start, 1, max_results, stop_after, idle_ms);
+        if (job < 0)
+            return 1;
+        printf("job %d submitted.\n", job);
+        while ((result_num = poll_job("/dev/nvme0n1", job, results, max_results, &total)) == FSR_JOB_PENDING)
+            sleep(1);
+    }
+    else
+        result_num = issue_task("/dev/nvme0n1", buf_start, buf_index - buf_start, 1, results, max_results, stop_after, &total);
+    if (result_num >= 0)
+        print_results(results, result_num, total, query >= 0 && argc <= 2 ? NULL : targets);
+    free(results);
 
     return 0;
 }
@@ -25,8 +25,83 @@
 #include <time.h>
 
 #define NVME_IOCTL_ADMIN_CMD	_IOWR('N', 0x41, struct nvme_admin_cmd)
+#define NVME_IOCTL_IO_CMD	_IOWR('N', 0x43, struct nvme_admin_cmd)
 #define ADMIN_GET_FEATURES 0x0A
+#define ADMIN_GET_LOG_PAGE 0x02
+#define FSR_IO_SEARCH 0x83  // the vendor specific I/O command of the tasks (bidirectional), dword10 is the kind of the task
+#define FSR_NSID 1
 #define MAX_HOST_CMD 4096
+#define MAX_CONFIG_UNIT 128  // must match SEARCH_CONFIG_MAX_UNIT of the firmware (search.h), about 43K extents
+
+// must match the firmware (match.h)
+#define MAX_PATTERN_NUM 64
+#define MAX_PATTERN_LEN 16
+
+// must match the firmware (match.h)
+#define BITAP_MAX_LEN 32
+#define BITAP_MAX_K 8
+
+// must match the firmware (match.h)
+#define BINARY_MAX_LEN 4096
+
+// must match the firmware (regex.h)
+#define REGEX_MAX_LEN 256
+
+// must match the firmware (search.h)
+#define SEARCH_OP_LITERAL 0
+#define SEARCH_OP_REGEX 1
+#define SEARCH_OP_APPROX 2
+#define SEARCH_OP_BINARY 3
+#define SEARCH_FLAG_ICASE 0x1
+#define SEARCH_FLAG_UTF8 0x2
+#define FSR_MAX_RESULT_NUM(config_units) ((256 - (config_units)) * 4096 / sizeof(struct fsr_result))
+#define FSR_RESULT_OVERFLOW 0x80000000
+#define FSR_RESULT_STOPPED 0x40000000
+#define FSR_RESULT_PENDING 0x20000000  // poll_job(): the background job is not done yet
+#define FSR_RESULT_UNREADABLE 0x10000000  // some pages could not be read, the results end with their ranges
+#define FSR_RESULT_INCREMENTAL 0x08000000  // an incremental task, its tail comes right before the unreadable ranges
+#define FSR_RESULT_COUNT(total) ((total) & ~(FSR_RESULT_OVERFLOW | FSR_RESULT_STOPPED | FSR_RESULT_PENDING | FSR_RESULT_UNREADABLE | FSR_RESULT_INCREMENTAL))
+#define FSR_UNREADABLE_ID 0xffffffff  // pattern_id of a range of the file the CSD could not read
+#define FSR_TAIL_ID 0xfffffffe  // pattern_id of the tail of an incremental task: the offset its scans reached, their hits in length
+#define FSR_WINDOW_INCREMENTAL 0x1  // see set_incremental()
+#define FSR_JOB_PENDING -2
+#define FSR_LOG_PAGE 0xC0  // the results log page of task i is FSR_LOG_PAGE + i
+#define FSR_JOB_DONE 3  // the states in struct fsr_log
+#define FSR_JOB_FAILED 4
+#define FSR_SC_CANCELLED 0x7  // NVMe status code of a task cancelled by cancel_task()
+#define FSR_SC_TIMEOUT 0xC0  // NVMe status code of a task past its timeout
+#define FSR_SC_NO_QUERY 0xC1  // NVMe status code of a task whose prepared query was replaced, prepare it again
+#define FSR_SC_BUSY 0xC2  // NVMe status code of a task sent while all the task slots of the CSD are running, send it again later
+#define FSR_OP_QUERY 0xff  // the opcode of put_query()
+#define FSR_QUERY_MAX_SIZE (3 * 4096)  // the pattern section of a prepared query
+
+// a match found by the CSD
+struct fsr_result {
+    __u64 offset;  // where the match starts in the file
+    __u32 pattern_id;  // FSR_UNREADABLE_ID for an unreadable range, FSR_TAIL_ID for the tail
+    __u32 length;  // the bytes of an unreadable range, the hits of the tail, 0 for a match
+};
+
+// the results end with the tail when FSR_RESULT_INCREMENTAL is set, then the unreadable ranges and an entry
+// of length 0 when FSR_RESULT_UNREADABLE is set, the tail and the ranges are kept
+static unsigned int result_num(struct fsr_result* results, unsigned int num, __u32 total){
+    for (unsigned int i = 0; i < num; i++){
+        if ((total & FSR_RESULT_UNREADABLE) && results[i].pattern_id == FSR_UNREADABLE_ID && results[i].length == 0)
+            return i;
+        if ((total & FSR_RESULT_INCREMENTAL) && !(total & FSR_RESULT_UNREADABLE) && results[i].pattern_id == FSR_TAIL_ID)
+            return i + 1;
+    }
+    return num;
+}
+
+// the first 4KB of the results log page, the results follow
+struct fsr_log {
+    __u32 state;  // FSR_JOB_DONE or FSR_JOB_FAILED once the task is done, 0 if there is no such task
+    __u32 status;  // the NVMe status code of the task, FSR_SC_TIMEOUT for example
+    __u32 specific;  // the total hit counts as in issue_task()
+    __u32 result_num;
+    __u32 total_hit_counts;  // every match, also for regex where specific counts the matching lines
+};
 
 // define for nvme admin cmd
 struct nvme_passthru_cmd {
@@ -52,54 +127,658 @@ struct nvme_passthru_cmd {
 
 #define nvme_admin_cmd nvme_passthru_cmd
 
+// the largest pattern section of the task config, the one of SEARCH_OP_BINARY
+#define MAX_PATTERN_SECTION (8 + 2 * BINARY_MAX_LEN)
+
+/**
+ * @brief pack the patterns into the head of the task config.
+ * 
+ * @param buf the config buffer, at least 4 + num * MAX_PATTERN_LEN bytes
+ * @param patterns the target strings, each shorter than MAX_PATTERN_LEN
+ * @param num the number of patterns
+ * @return the bytes written, 0 if the patterns can not be packed
+ */
+unsigned int put_patterns(char* buf, const char** patterns, unsigned int num){
+    if (num == 0 || num > MAX_PATTERN_NUM) {
+        printf("the number of patterns should between 1 and %d!\n", MAX_PATTERN_NUM);
+        return 0;
+    }
+
+    *((unsigned int *)buf) = num;
+    for (unsigned int i = 0; i < num; i++) {
+        unsigned int len = strlen(patterns[i]);
+        if (len == 0 || len >= MAX_PATTERN_LEN) {
+            printf("the length of pattern \"%s\" should between 1 and %d!\n", patterns[i], MAX_PATTERN_LEN - 1);
+            return 0;
+        }
+        memset(buf + 4 + i * MAX_PATTERN_LEN, 0, MAX_PATTERN_LEN);
+        memcpy(buf + 4 + i * MAX_PATTERN_LEN, patterns[i], len);
+    }
+
+    return 4 + num * MAX_PATTERN_LEN;
+}
+
+/**
+ * @brief pack a regular expression into the head of the task config, the
+ * firmware compiles it into a DFA and matches the file line by line.
+ * 
+ * @param buf the config buffer, at least 4 + REGEX_MAX_LEN bytes
+ * @param regex the pattern, shorter than REGEX_MAX_LEN
+ * @return the bytes written, 0 if the pattern is too long
+ */
+unsigned int put_regex(char* buf, const char* regex){
+    unsigned int len = strlen(regex);
+
+    if (len == 0 || len >= REGEX_MAX_LEN) {
+        printf("the length of the regex should between 1 and %d!\n", REGEX_MAX_LEN - 1);
+        return 0;
+    }
+
+    *((unsigned int *)buf) = 1 | (SEARCH_OP_REGEX << 16);
+    memset(buf + 4, 0, REGEX_MAX_LEN);
+    memcpy(buf + 4, regex, len);
+
+    return 4 + REGEX_MAX_LEN;
+}
+
 /**
- * @brief issue the task to the CSD.
+ * @brief pack a pattern for approximate matching into the head of the task
+ * config, the matches are found within k edits (insertions, deletions or
+ * substitutions).
+ * 
+ * @param buf the config buffer, at least 8 + BITAP_MAX_LEN bytes
+ * @param pattern the pattern, longer than k and shorter than BITAP_MAX_LEN
+ * @param k the edit distance allowed, at most BITAP_MAX_K
+ * @return the bytes written, 0 if the pattern or k is invalid
+ */
+unsigned int put_approx(char* buf, const char* pattern, unsigned int k){
+    unsigned int len = strlen(pattern);
+
+    if (k > BITAP_MAX_K || len <= k || len >= BITAP_MAX_LEN) {
+        printf("k should be at most %d, and the length of the pattern between k + 1 and %d!\n", BITAP_MAX_K, BITAP_MAX_LEN - 1);
+        return 0;
+    }
+
+    *((unsigned int *)buf) = 1 | (SEARCH_OP_APPROX << 16);
+    *((unsigned int *)(buf + 4)) = k;
+    memset(buf + 8, 0, BITAP_MAX_LEN);
+    memcpy(buf + 8, pattern, len);
+
+    return 8 + BITAP_MAX_LEN;
+}
+
+/**
+ * @brief pack a binary pattern into the head of the task config. It may hold
+ * any byte, 0x00 included, and a data byte c matches pattern[i] if
+ * (c & mask[i]) == (pattern[i] & mask[i]).
+ * 
+ * @param buf the config buffer, at least MAX_PATTERN_SECTION bytes
+ * @param pattern the pattern bytes
+ * @param mask the bits of each byte that have to match, 0x00 for a wildcard byte
+ * @param len the length of the pattern, at most BINARY_MAX_LEN
+ * @return the bytes written, 0 if the pattern is too long
+ */
+unsigned int put_binary(char* buf, const unsigned char* pattern, const unsigned char* mask, unsigned int len){
+    unsigned int size = (2 * len + 3) / 4 * 4;  // the window after it stays aligned
+
+    if (len == 0 || len > BINARY_MAX_LEN) {
+        printf("the length of the binary pattern should between 1 and %d!\n", BINARY_MAX_LEN);
+        return 0;
+    }
+
+    *((unsigned int *)buf) = 1 | (SEARCH_OP_BINARY << 16);
+    *((unsigned int *)(buf + 4)) = len;
+    memset(buf + 8, 0, size);
+    memcpy(buf + 8, pattern, len);
+    memcpy(buf + 8 + len, mask, len);
+
+    return 8 + size;
+}
+
+/**
+ * @brief parse a binary pattern written in hex, e.g. "de ad ?? 0f", where a
+ * '?' nibble matches anything. Spaces are ignored.
+ * 
+ * @param hex the pattern in hex
+ * @param pattern filled with the pattern bytes, BINARY_MAX_LEN at most
+ * @param mask filled with the byte masks
+ * @return the length of the pattern, 0 if hex is invalid
+ */
+unsigned int parse_hex_pattern(const char* hex, unsigned char* pattern, unsigned char* mask){
+    unsigned int len = 0, nibble = 0;
+
+    for (; *hex; hex++) {
+        unsigned int value, bits = 0xf;
+
+        if (*hex == ' ')
+            continue;
+        if (*hex == '?')
+            value = bits = 0;
+        else if (*hex >= '0' && *hex <= '9')
+            value = *hex - '0';
+        else if ((*hex | 0x20) >= 'a' && (*hex | 0x20) <= 'f')
+            value = (*hex | 0x20) - 'a' + 10;
+        else {
+            printf("invalid hex digit '%c' in the binary pattern!\n", *hex);
+            return 0;
+        }
+
+        if (len >= BINARY_MAX_LEN) {
+            printf("the binary pattern is longer than %d bytes!\n", BINARY_MAX_LEN);
+            return 0;
+        }
+        if (nibble == 0) {
+            pattern[len] = value << 4;
+            mask[len] = bits << 4;
+        }
+        else {
+            pattern[len] |= value;
+            mask[len] |= bits;
+            len++;
+        }
+        nibble ^= 1;
+    }
+
+    if (nibble) {
+        printf("the binary pattern should have an even number of hex digits!\n");
+        return 0;
+    }
+    return len;
+}
+
+/**
+ * @brief set the flags of the task in the header written by the put_* functions.
+ * 
+ * @param buf the config buffer, after the patterns are packed
+ * @param flags SEARCH_FLAG_ICASE for ASCII case-insensitive matching, SEARCH_FLAG_UTF8
+ * to fold the 2-byte UTF-8 letters as well (literal patterns only)
+ */
+void set_search_flags(char* buf, unsigned int flags){
+    *((unsigned int *)buf) |= flags << 24;
+}
+
+/**
+ * @brief pack the (offset, length) window of the task, it follows the patterns.
+ * 
+ * @param buf the config buffer, at least 32 bytes
+ * @param offset the first byte of the file to search
+ * @param length the bytes to search, 0 for up to the end of the file
+ * @param file_size the size of the file, only used by the firmware when the extents are given
+ * @param timeout_ms the task fails with FSR_SC_TIMEOUT if it runs longer, 0 for never
+ * @return the bytes written
+ */
+unsigned int put_window(char* buf, __u64 offset, __u64 length, __u64 file_size, unsigned int timeout_ms){
+    __u64 *window = (__u64 *)buf;
+
+    window[0] = offset;
+    window[1] = length;
+    window[2] = file_size;
+    window[3] = timeout_ms;  // the upper half is reserved
+
+    return 4 * sizeof(__u64);
+}
+
+/**
+ * @brief make the task incremental: the CSD searches the file from where the
+ * last incremental task over it with the same prepared query ended, and
+ * returns the matches found since with a FSR_TAIL_ID result holding the hits
+ * of all the scans. The task needs a path and a prepared query, the window
+ * is ignored, and the last line of a regex only counts once it ends with '\n'.
+ *
+ * @param window the window written by put_window()
+ */
+void set_incremental(char* window){
+    ((__u32 *)window)[7] |= FSR_WINDOW_INCREMENTAL;
+}
+
+// print why the CSD failed a task from the NVMe status
+static void print_status(int err){
+    if ((err & 0x7ff) == FSR_SC_CANCELLED)
+        printf("the task is cancelled\n");
+    else if ((err & 0x7ff) == FSR_SC_TIMEOUT)
+        printf("the task timed out\n");
+    else if ((err & 0x7ff) == FSR_SC_NO_QUERY)
+        printf("the prepared query is gone, prepare it again\n");
+    else if ((err & 0x7ff) == FSR_SC_BUSY)
+        printf("all the task slots of the CSD are running, try again later\n");
+    else
+        printf("the CSD rejected the task, status 0x%x\n", err);
+}
+
+/**
+ * @brief issue the task to the CSD and wait for it.
  * 
  * @param dev_nvme the path of the device
  * @param buf including the configurations of the task
- * @param buf_len the length of the buffer
+ * @param buf_len the length of the config, at most MAX_CONFIG_UNIT * 4KB
  * @param retrieve 1 for in-storage retrieving, 0 for not
+ * @param results filled with the matches found, in no particular order, can be NULL if max_results is 0
+ * @param max_results the cap of the results, at most FSR_MAX_RESULT_NUM of the config units
+ * @param stop_after stop the task once this many matches (matching lines for regex) are found, 0 to search everything
+ *        (the task is tagged with the pid, so cancel_task() from another process stops it)
+ * @param total set to the total hit counts (the matching lines for regex, one result each), FSR_RESULT_OVERFLOW
+ *        is set if some results are dropped, FSR_RESULT_STOPPED if the task stopped early
+ * @return the number of results filled, -1 on failure
  */
-void issue_task(char* dev_nvme, char* buf, unsigned int buf_len, unsigned int retrieve){
-    __u32 namespace_id = 0;
-    __u32 feature_id = retrieve ? 0x12 : 0x11;  // not 0x11
-    __u8 opcode= ADMIN_GET_FEATURES;
+int issue_task(char* dev_nvme, char* buf, unsigned int buf_len, unsigned int retrieve,
+               struct fsr_result* results, unsigned int max_results, unsigned int stop_after, __u32* total){
+    __u32 kind = retrieve ? 0x12 : 0x11;  // as the FID of the search Get Features
+
+    // the config in the first 4KB units, followed by the results
+    unsigned int config_units = (buf_len + MAX_HOST_CMD - 1) / MAX_HOST_CMD;
+    if (config_units == 0)
+        config_units = 1;
+    if (config_units > MAX_CONFIG_UNIT) {
+        printf("the task config is larger than %d bytes!\n", MAX_CONFIG_UNIT * MAX_HOST_CMD);
+        return -1;
+    }
+    if (max_results > FSR_MAX_RESULT_NUM(config_units))
+        max_results = FSR_MAX_RESULT_NUM(config_units);
+
+    unsigned int result_size = (max_results * sizeof(struct fsr_result) + 4095) / 4096 * 4096;
+    unsigned int data_len = config_units * MAX_HOST_CMD + result_size;
 
     //allocate a aligned buf to send
     void *buf_posix_memalign = NULL;
-    if (posix_memalign(&buf_posix_memalign, getpagesize(),MAX_HOST_CMD)) {
+    if (posix_memalign(&buf_posix_memalign, getpagesize(), data_len)) {
         printf("can not allocate feature payload\n");
+        return -1;
     }
 
-    memset(buf_posix_memalign, 0, MAX_HOST_CMD);
+    memset(buf_posix_memalign, 0, data_len);
     //copy from buf which user inputted to aligined buffer
     memcpy((void *)buf_posix_memalign,(void *)buf,buf_len);
 
     //start to send
     //Open nvme devices
     int fd= open(dev_nvme,O_RDONLY);
-    if (fd < 0) 
+    if (fd < 0) {
         printf("Wrong args:dev_nvme.can't open dev_nvme.\n");
+        free(buf_posix_memalign);
+        return -1;
+    }
 
     //fill in DMA struct
     struct nvme_admin_cmd cmd = {
-    .opcode		= opcode,
-    .nsid		= namespace_id,
-    .cdw10		= feature_id,
-    .cdw11		= 32,
-    .cdw12		= 22,
+    .opcode		= FSR_IO_SEARCH,
+    .nsid		= FSR_NSID,
+    .cdw10		= kind,
+    .cdw11		= max_results,
+    .cdw12		= getpid(),  // the tag to cancel the task
+    .cdw13		= config_units,
+    .cdw14		= stop_after,
+    .addr		= (__u64)(uintptr_t) buf_posix_memalign,
+    .data_len	= data_len,
+	};
+
+    //send to devices, on an I/O queue so that the admin queue stays free
+    int err = ioctl(fd, NVME_IOCTL_IO_CMD, &cmd);
+    close(fd);
+
+    if(err < 0){
+      printf("[dma] ioctl failed!\n");
+      free(buf_posix_memalign);
+      return -1;
+    }
+    if(err > 0){  // the NVMe status
+      print_status(err);
+      free(buf_posix_memalign);
+      return -1;
+    }
+
+    *total = cmd.result;
+    unsigned int num = (cmd.result & (FSR_RESULT_UNREADABLE | FSR_RESULT_INCREMENTAL)) ? max_results : FSR_RESULT_COUNT(cmd.result);
+    if (num > max_results)
+        num = max_results;
+    memcpy(results, (char *)buf_posix_memalign + config_units * MAX_HOST_CMD, num * sizeof(struct fsr_result));
+
+    free(buf_posix_memalign);
+    return result_num(results, num, cmd.result);
+}
+
+// send a task whose command completes once the config is received, return its id
+static int submit_detached(char* dev_nvme, char* buf, unsigned int buf_len, __u32 kind,
+                           unsigned int max_results, unsigned int stop_after, unsigned int idle_ms){
+    unsigned int config_units = (buf_len + MAX_HOST_CMD - 1) / MAX_HOST_CMD;
+    if (config_units == 0)
+        config_units = 1;
+    if (config_units > MAX_CONFIG_UNIT) {
+        printf("the task config is larger than %d bytes!\n", MAX_CONFIG_UNIT * MAX_HOST_CMD);
+        return -1;
+    }
+    if (max_results > FSR_MAX_RESULT_NUM(0))
+        max_results = FSR_MAX_RESULT_NUM(0);
+
+    unsigned int data_len = config_units * MAX_HOST_CMD;
+    void *buf_posix_memalign = NULL;
+    if (posix_memalign(&buf_posix_memalign, getpagesize(), data_len)) {
+        printf("can not allocate feature payload\n");
+        return -1;
+    }
+    memset(buf_posix_memalign, 0, data_len);
+    memcpy((void *)buf_posix_memalign, (void *)buf, buf_len);
+
+    int fd = open(dev_nvme, O_RDONLY);
+    if (fd < 0) {
+        printf("Wrong args:dev_nvme.can't open dev_nvme.\n");
+        free(buf_posix_memalign);
+        return -1;
+    }
+
+    struct nvme_admin_cmd cmd = {
+    .opcode		= FSR_IO_SEARCH,
+    .nsid		= FSR_NSID,
+    .cdw10		= kind,
+    .cdw11		= max_results,
+    .cdw12		= getpid(),
+    .cdw13		= config_units,
+    .cdw14		= stop_after,
+    .cdw15		= idle_ms,
     .addr		= (__u64)(uintptr_t) buf_posix_memalign,
-    .data_len	= MAX_HOST_CMD,
+    .data_len	= data_len,
 	};
 
-    //send to devices
-    int err = ioctl(fd, NVME_IOCTL_ADMIN_CMD, cmd);
+    int err = ioctl(fd, NVME_IOCTL_IO_CMD, &cmd);
+    close(fd);
+    free(buf_posix_memalign);
 
     if(err < 0){
       printf("[dma] ioctl failed!\n");
+      return -1;
+    }
+    if(err > 0){
+      print_status(err);
+      return -1;
+    }
+    return cmd.result;
+}
+
+/**
+ * @brief submit a background job, the CSD only searches the file while there
+ * is no host I/O, the command completes once the config is received.
+ *
+ * @param idle_ms how long the host has to be idle before the job runs, 0 for the default of the CSD (100ms)
+ * @return the job id for poll_job() or read_task_log(), -1 on failure
+ */
+int submit_job(char* dev_nvme, char* buf, unsigned int buf_len, unsigned int retrieve,
+               unsigned int max_results, unsigned int stop_after, unsigned int idle_ms){
+    return submit_detached(dev_nvme, buf, buf_len, retrieve ? 0x17 : 0x16, max_results, stop_after, idle_ms);
+}
+
+/**
+ * @brief submit an asynchronous task, it runs at once but its command
+ * completes as soon as the config is received, so the admin queue is not held
+ * during the scan. The CSD posts a vendor specific asynchronous event naming
+ * the log page of the task when it is done.
+ *
+ * @return the task id for read_task_log(), -1 on failure
+ */
+int submit_task(char* dev_nvme, char* buf, unsigned int buf_len, unsigned int retrieve,
+                unsigned int max_results, unsigned int stop_after){
+    return submit_detached(dev_nvme, buf, buf_len, retrieve ? 0x1B : 0x1A, max_results, stop_after, 0);
+}
+
+/**
+ * @brief read the results log page of an asynchronous task or a background
+ * job, the task is freed once it is read after it is done.
+ *
+ * @param results filled with the matches found, can be NULL if max_results is 0
+ * @param max_results the cap given when the task was submitted
+ * @param total set to the total hit counts as in issue_task()
+ * @return the number of results filled, FSR_JOB_PENDING if the task is not done, -1 on failure
+ */
+int read_task_log(char* dev_nvme, unsigned int task_id, struct fsr_result* results, unsigned int max_results, __u32* total){
+    if (max_results > FSR_MAX_RESULT_NUM(1))
+        max_results = FSR_MAX_RESULT_NUM(1);
+
+    // the header in the first 4KB, the results after it
+    unsigned int data_len = MAX_HOST_CMD + (max_results * sizeof(struct fsr_result) + 4095) / 4096 * 4096;
+    void *buf_posix_memalign = NULL;
+    if (posix_memalign(&buf_posix_memalign, getpagesize(), data_len)) {
+        printf("can not allocate log page payload\n");
+        return -1;
+    }
+    memset(buf_posix_memalign, 0, data_len);
+
+    int fd = open(dev_nvme, O_RDONLY);
+    if (fd < 0) {
+        printf("Wrong args:dev_nvme.can't open dev_nvme.\n");
+        free(buf_posix_memalign);
+        return -1;
+    }
+
+    __u32 numd = data_len / 4 - 1;  // 0's based
+    struct nvme_admin_cmd cmd = {
+    .opcode		= ADMIN_GET_LOG_PAGE,
+    .nsid		= 0xffffffff,
+    .cdw10		= (FSR_LOG_PAGE + task_id) | (numd << 16),
+    .cdw11		= numd >> 16,
+    .addr		= (__u64)(uintptr_t) buf_posix_memalign,
+    .data_len	= data_len,
+	};
+
+    int err = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+    close(fd);
+
+    struct fsr_log *log = (struct fsr_log *)buf_posix_memalign;
+    int num = -1;
+    if(err < 0)
+      printf("[dma] ioctl failed!\n");
+    else if(err > 0)
+      printf("can not read the log page of task %u, status 0x%x\n", task_id, err);
+    else if(log->state == 0)
+      printf("no task %u on the CSD\n", task_id);
+    else if(log->state != FSR_JOB_DONE && log->state != FSR_JOB_FAILED)
+      num = FSR_JOB_PENDING;
+    else if(log->status)
+      print_status(log->status);
+    else {
+      *total = log->specific;
+      num = log->result_num < max_results ? log->result_num : max_results;
+      memcpy(results, (char *)buf_posix_memalign + MAX_HOST_CMD, num * sizeof(struct fsr_result));
+      num = result_num(results, num, log->specific);
     }
 
-    return;
+    free(buf_posix_memalign);
+    return num;
+}
+
+/**
+ * @brief poll a background job, the job is freed once its results are returned.
+ *
+ * @param results filled with the matches found, can be NULL if max_results is 0
+ * @param max_results the cap given to submit_job()
+ * @param total set to the total hit counts as in issue_task()
+ * @return the number of results filled, FSR_JOB_PENDING if the job is not done, -1 on failure
+ */
+int poll_job(char* dev_nvme, unsigned int job_id, struct fsr_result* results, unsigned int max_results, __u32* total){
+    if (max_results > FSR_MAX_RESULT_NUM(0))
+        max_results = FSR_MAX_RESULT_NUM(0);
+
+    unsigned int data_len = (max_results * sizeof(struct fsr_result) + 4095) / 4096 * 4096;
+    if (data_len == 0)
+        data_len = 4096;
+    void *buf_posix_memalign = NULL;
+    if (posix_memalign(&buf_posix_memalign, getpagesize(), data_len)) {
+        printf("can not allocate feature payload\n");
+        return -1;
+    }
+
+    int fd = open(dev_nvme, O_RDONLY);
+    if (fd < 0) {
+        printf("Wrong args:dev_nvme.can't open dev_nvme.\n");
+        free(buf_posix_memalign);
+        return -1;
+    }
+
+    struct nvme_admin_cmd cmd = {
+    .opcode		= ADMIN_GET_FEATURES,
+    .cdw10		= 0x18,
+    .cdw11		= job_id,
+    .addr		= (__u64)(uintptr_t) buf_posix_memalign,
+    .data_len	= data_len,
+	};
+
+    int err = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+    close(fd);
+
+    if(err != 0){
+      if (err < 0)
+        printf("[dma] ioctl failed!\n");
+      else if ((err & 0x7ff) == FSR_SC_TIMEOUT)
+        print_status(err);
+      else
+        printf("no job %u on the CSD or it failed, status 0x%x\n", job_id, err);
+      free(buf_posix_memalign);
+      return -1;
+    }
+    if (cmd.result & FSR_RESULT_PENDING){
+      free(buf_posix_memalign);
+      return FSR_JOB_PENDING;
+    }
+
+    *total = cmd.result;
+    unsigned int num = (cmd.result & (FSR_RESULT_UNREADABLE | FSR_RESULT_INCREMENTAL)) ? max_results : FSR_RESULT_COUNT(cmd.result);
+    if (num > max_results)
+        num = max_results;
+    memcpy(results, buf_posix_memalign, num * sizeof(struct fsr_result));
+
+    free(buf_posix_memalign);
+    return result_num(results, num, cmd.result);
+}
+
+/**
+ * @brief compile a pattern set on the CSD once, so that the tasks using it
+ * with put_query() neither send nor build it again. The CSD keeps a few
+ * queries and replaces the least recently used one, a task whose query is
+ * gone fails with FSR_SC_NO_QUERY.
+ *
+ * @param buf the pattern section, as written by the put_* functions and set_search_flags()
+ * @param buf_len its length, at most FSR_QUERY_MAX_SIZE
+ * @return the handle of the query, -1 on failure
+ */
+int prepare_query(char* dev_nvme, char* buf, unsigned int buf_len){
+    unsigned int config_units = (buf_len + MAX_HOST_CMD - 1) / MAX_HOST_CMD;
+    if (buf_len == 0 || buf_len > FSR_QUERY_MAX_SIZE) {
+        printf("the pattern section of a query should be at most %d bytes!\n", FSR_QUERY_MAX_SIZE);
+        return -1;
+    }
+
+    unsigned int data_len = config_units * MAX_HOST_CMD;
+    void *buf_posix_memalign = NULL;
+    if (posix_memalign(&buf_posix_memalign, getpagesize(), data_len)) {
+        printf("can not allocate feature payload\n");
+        return -1;
+    }
+    memset(buf_posix_memalign, 0, data_len);
+    memcpy((void *)buf_posix_memalign, (void *)buf, buf_len);
+
+    int fd = open(dev_nvme, O_RDONLY);
+    if (fd < 0) {
+        printf("Wrong args:dev_nvme.can't open dev_nvme.\n");
+        free(buf_posix_memalign);
+        return -1;
+    }
+
+    struct nvme_admin_cmd cmd = {
+    .opcode		= FSR_IO_SEARCH,
+    .nsid		= FSR_NSID,
+    .cdw10		= 0x1C,
+    .cdw13		= config_units,
+    .addr		= (__u64)(uintptr_t) buf_posix_memalign,
+    .data_len	= data_len,
+	};
+
+    int err = ioctl(fd, NVME_IOCTL_IO_CMD, &cmd);
+    close(fd);
+    free(buf_posix_memalign);
+
+    if(err < 0){
+      printf("[dma] ioctl failed!\n");
+      return -1;
+    }
+    if(err > 0){
+      if ((err & 0x7ff) == FSR_SC_BUSY)
+        print_status(err);
+      else
+        printf("the CSD rejected the patterns, status 0x%x\n", err);
+      return -1;
+    }
+    return cmd.result;
+}
+
+/**
+ * @brief use a prepared query instead of the patterns at the head of the task
+ * config, the window follows as usual.
+ *
+ * @param buf the config buffer, at least 4 bytes
+ * @param handle returned by prepare_query()
+ * @return the bytes written
+ */
+unsigned int put_query(char* buf, unsigned int handle){
+    *((unsigned int *)buf) = (handle & 0xffff) | (FSR_OP_QUERY << 16);
+    return 4;
+}
+
+/**
+ * @brief cancel the tasks and background jobs issued by a process, they
+ * complete with FSR_SC_CANCELLED.
+ *
+ * @param tag the pid of the process that issued them
+ * @return the number of the tasks cancelled, -1 on failure
+ */
+int cancel_task(char* dev_nvme, unsigned int tag){
+    int fd = open(dev_nvme, O_RDONLY);
+    if (fd < 0) {
+        printf("Wrong args:dev_nvme.can't open dev_nvme.\n");
+        return -1;
+    }
+
+    struct nvme_admin_cmd cmd = {
+    .opcode		= ADMIN_GET_FEATURES,
+    .cdw10		= 0x19,
+    .cdw11		= tag,
+	};
+
+    int err = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+    close(fd);
+
+    if(err < 0){
+      printf("[dma] ioctl failed!\n");
+      return -1;
+    }
+    if(err > 0){
+      printf("no task of %u on the CSD\n", tag);
+      return -1;
+    }
+    return cmd.result;
+}
+
+// print the results sorted by their offsets
+static int cmp_result(const void *a, const void *b){
+    const struct fsr_result *x = a, *y = b;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return (int)x->pattern_id - (int)y->pattern_id;
+}
+
+void print_results(struct fsr_result* results, int num, __u32 total, const char** patterns){
+    printf("total hit counts: %u%s%s%s%s\n", FSR_RESULT_COUNT(total),
+           (total & FSR_RESULT_INCREMENTAL) ? " since the last scan" : "",
+           (total & FSR_RESULT_OVERFLOW) ? ", some results are dropped" : "",
+           (total & FSR_RESULT_STOPPED) ? ", stopped early" : "",
+           (total & FSR_RESULT_UNREADABLE) ? ", some pages could not be read" : "");
+
+    qsort(results, num, sizeof(struct fsr_result), cmp_result);
+    for (int i = 0; i < num; i++)
+        if (results[i].pattern_id == FSR_UNREADABLE_ID)
+            printf("%llu: %u bytes not searched, unreadable\n", (unsigned long long)results[i].offset, results[i].length);
+        else if (results[i].pattern_id == FSR_TAIL_ID)
+            printf("%llu: searched up to here, %u hits since the first scan\n", (unsigned long long)results[i].offset, results[i].length);
+        else if (patterns)
+            printf("%llu: %s\n", (unsigned long long)results[i].offset, patterns[results[i].pattern_id]);
+        else
+            printf("%llu: pattern %u\n", (unsigned long long)results[i].offset, results[i].pattern_id);
 }
 
 #endif
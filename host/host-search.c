@@ -18,8 +18,44 @@ int main(int argc, char *argv[]){
     struct fiemap *fiemap;
     // struct fiemap_extent* extents; //store extents of file
 
+    unsigned long long offset = 0, length = 0;
+    unsigned int max_results = 1024, stop_after = 0, timeout_ms = 0;
+    int regex = 0, binary = 0, k = -1;
+    unsigned int flags = 0;
+    int opt;
+    struct stat st;
+
+    while ((opt = getopt(argc, argv, "o:l:n:m:t:rk:xiu")) != -1) {
+        if (opt == 'o')
+            offset = strtoull(optarg, NULL, 0);
+        else if (opt == 'l')
+            length = strtoull(optarg, NULL, 0);
+        else if (opt == 'n')
+            max_results = strtoul(optarg, NULL, 0);
+        else if (opt == 'm')
+            stop_after = strtoul(optarg, NULL, 0);  // stop after that many matches, 1 to only ask whether there is one
+        else if (opt == 't')
+            timeout_ms = strtoul(optarg, NULL, 0);  // the task fails if it runs longer
+        else if (opt == 'r')
+            regex = 1;  // the first pattern is a regular expression
+        else if (opt == 'k')
+            k = atoi(optarg);  // the first pattern is matched within k edits
+        else if (opt == 'x')
+            binary = 1;  // the first pattern is binary, in hex
+        else if (opt == 'i')
+            flags |= SEARCH_FLAG_ICASE;
+        else if (opt == 'u')
+            flags |= SEARCH_FLAG_ICASE | SEARCH_FLAG_UTF8;
+        else {
+            printf("Usage: host-search [-o offset] [-l length] [-n max_results] [-m stop_after] [-t timeout_ms] [-r | -k edits | -x] [-i | -u] [file [pattern ...]]\n");
+            return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     char *txt_file;
-    if(argc != 2){
+    if(argc < 2){
         txt_file = "/home/nvme/d1/d2/d3/d4/d5/hello_16KB.txt";
         printf ("no file is provided, use default: %s\n", txt_file);
     }
@@ -32,6 +68,8 @@ int main(int argc, char *argv[]){
     file_fd = open(txt_file, O_RDWR);
     if (file_fd < 0)
         return 1;
+    if (fstat(file_fd, &st) < 0)
+        return 1;
 
     fiemap = (struct fiemap *)malloc(sizeof(struct fiemap));
     memset(fiemap, 0, sizeof(struct fiemap));
@@ -59,17 +97,32 @@ int main(int argc, char *argv[]){
     }
 
     //repare data buffer
-    int buf_size = sizeof(struct addr_extent) * num_extent + sizeof(int) + 16;
+    int buf_size = sizeof(struct addr_extent) * num_extent + sizeof(int) + MAX_PATTERN_SECTION + 32;
     char* buf_start = (char*)malloc(buf_size);
     memset(buf_start,0,buf_size);
 
     char* buf_index = buf_start;
 
-    //repare target string
-    char target[16] = "hello";
-    //copy target string
-    memcpy(buf_index,target,16);
-    buf_index += 16;
+    //repare target strings
+    const char *default_target[1] = {"hello"};
+    const char **targets = argc > 2 ? (const char **)(argv + 2) : default_target;
+    unsigned int target_num = argc > 2 ? argc - 2 : 1;
+    unsigned char pattern[BINARY_MAX_LEN], mask[BINARY_MAX_LEN];
+    unsigned int binary_len = binary ? parse_hex_pattern(targets[0], pattern, mask) : 0;
+    if (binary && binary_len == 0)
+        return 1;
+
+    //copy target strings
+    unsigned int pattern_size = regex ? put_regex(buf_index, targets[0]) :
+                                binary ? put_binary(buf_index, pattern, mask, binary_len) :
+                                k >= 0 ? put_approx(buf_index, targets[0], k) : put_patterns(buf_index, targets, target_num);
+    if (pattern_size == 0)
+        return 1;
+    set_search_flags(buf_index, flags);
+    buf_index += pattern_size;
+
+    //copy the window, the extents are rounded to blocks so the file size is needed
+    buf_index += put_window(buf_index, offset, length, st.st_size, timeout_ms);
 
     //copy extent size 
     memcpy(buf_index,(char*)(&num_extent),sizeof(int));
@@ -87,7 +140,12 @@ int main(int argc, char *argv[]){
         buf_index += sizeof(struct addr_extent);
     }
     
-    issue_task("/dev/nvme0n1",buf_start,buf_size, 0);
+    struct fsr_result *results = (struct fsr_result *)malloc(max_results * sizeof(struct fsr_result));
+    __u32 total;
+    int result_num = issue_task("/dev/nvme0n1", buf_start, buf_index - buf_start, 0, results, max_results, stop_after, &total);
+    if (result_num >= 0)
+        print_results(results, result_num, total, targets);
+    free(results);
 
     close(file_fd);
     free(buf_start);
@@ -0,0 +1,9 @@
+#!/bin/bash
+
+# how much the search reads and the host I/O were throttled by each other, and the search reads saved by sharing
+names=("search reads deferred for the host" "search pushes held by the quota" "host pushes on a full queue" "search pages sharing another read")
+
+for i in 0 1 2 3; do
+    value=$(nvme get-feature /dev/nvme0n1 -f 0x15 --cdw11=$i | grep -o "value:0x[0-9a-fA-F]*" | cut -d: -f2)
+    echo "${names[$i]}: $((value))"
+done
@@ -0,0 +1,102 @@
+/**
+ * @file search-bench.c
+ * @author Lin Li
+ * @brief microbenchmark of the in-storage search kernels on 16 KB pages. It
+ * builds the firmware's match.c directly, so the numbers on an ARM board
+ * (-mfpu=neon) are the ones the CSD will see.
+ *
+ * gcc -O2 -I"../CSD firmware" search-bench.c "../CSD firmware/match.c" -o search-bench
+ *
+ * NOTE: Sunday() does not count overlapping occurrences, so its hit count can
+ * be lower than the other kernels for self-overlapping patterns.
+ *
+ * @copyright Copyright (c) 2023 Chongqing University StarLab
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "match.h"
+
+#define PAGE_SIZE 16384
+#define PAGE_NUM 256  // 4 MB of page data per round
+
+static struct acAutomaton ac;
+
+static double now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// the same page layout as generate_hello_file.py, or random lower-case text
+static void fill_pages(unsigned char *pages, int random_text){
+    for (int i = 0; i < PAGE_NUM; i++) {
+        unsigned char *page = pages + i * PAGE_SIZE;
+        if (random_text) {
+            for (int j = 0; j < PAGE_SIZE; j++)
+                page[j] = (rand() % 8 == 0) ? ' ' : 'a' + rand() % 26;
+        }
+        else {
+            int len = sprintf((char *)page, "12hello%d", i);
+            memset(page + len, '0', PAGE_SIZE - len);
+        }
+    }
+}
+
+static void report(const char *name, double us, unsigned int count){
+    double mb = (double)PAGE_NUM * PAGE_SIZE / (1024 * 1024);
+    printf("  %-16s %8.1f us/page %8.1f MB/s  hits: %u\n", name, us / PAGE_NUM, mb / (us / 1e6), count);
+}
+
+int main(int argc, char *argv[]){
+    const char *pattern = argc > 1 ? argv[1] : "hello";
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+    struct sundayTable table;
+    char patterns[1][MAX_PATTERN_LEN] = {{0}};
+    double t;
+    unsigned int count;
+
+    if (strlen(pattern) >= MAX_PATTERN_LEN) {
+        printf("the length of pattern should be less than %d!\n", MAX_PATTERN_LEN);
+        return 1;
+    }
+    strcpy(patterns[0], pattern);
+
+    // some padding, Sunday() may look one window past the end of the page
+    unsigned char *pages = malloc(PAGE_NUM * PAGE_SIZE + MAX_PATTERN_LEN);
+    memset(pages + PAGE_NUM * PAGE_SIZE, 0, MAX_PATTERN_LEN);
+
+    sunday_build(&table, pattern, 0);
+    ac_build(&ac, patterns, 1, 0);
+
+    for (int random_text = 0; random_text < 2; random_text++) {
+        fill_pages(pages, random_text);
+        printf("pattern \"%s\", %s pages, %d rounds:\n", pattern, random_text ? "random text" : "hello file", rounds);
+
+        t = now_us(); count = 0;
+        for (int r = 0; r < rounds; r++)
+            for (int i = 0; i < PAGE_NUM; i++)
+                count += Sunday((char *)pages + i * PAGE_SIZE, patterns[0]);
+        report("Sunday()", (now_us() - t) / rounds, count / rounds);
+
+        t = now_us(); count = 0;
+        for (int r = 0; r < rounds; r++)
+            for (int i = 0; i < PAGE_NUM; i++)
+                count += sunday_search(&table, pages + i * PAGE_SIZE, PAGE_SIZE, NULL);
+        report("sunday_search()", (now_us() - t) / rounds, count / rounds);
+
+        t = now_us(); count = 0;
+        for (int r = 0; r < rounds; r++) {
+            unsigned int hits[1] = {0};
+            for (int i = 0; i < PAGE_NUM; i++)
+                count += ac_search(&ac, pages + i * PAGE_SIZE, PAGE_SIZE, hits, NULL);
+        }
+        report("ac_search()", (now_us() - t) / rounds, count / rounds);
+    }
+
+    free(pages);
+    return 0;
+}